@@ -1,6 +1,20 @@
 #pragma once
 
 #include <array>
+#include <algorithm>
+#include <stdint.h>
+#if PICO_ON_DEVICE
+#include <hardware/sync.h>
+#include <hardware/timer.h>
+#else
+#include <atomic>
+#include "host_port.h"
+#endif
+#include "debug.h"
+
+#if !defined(RING_STATS_ENABLE)
+#define RING_STATS_ENABLE   PRINT_STATS
+#endif
 
 namespace data_structure
 {
@@ -11,6 +25,8 @@ namespace data_structure
 
         value_type* begin() { return buffer.begin(); }
         value_type* end() { return buffer.end(); }
+        const value_type* begin() const { return buffer.begin(); }
+        const value_type* end() const { return buffer.end(); }
 
         std::array<T, N> buffer;
     };
@@ -22,6 +38,7 @@ namespace data_structure
 
         value_type* begin() const { return begin_addr; }
         value_type* end() const { return end_addr; }
+        size_t size() const { return end_addr - begin_addr; }
 
         container_range() = default;
         container_range(value_type* begin_addr, value_type* end_addr)
@@ -33,7 +50,76 @@ namespace data_structure
         value_type* end_addr = nullptr;
     };
 
-    template<typename Cntr> class circular_buffer
+    // up to two contiguous ranges of a ring in order. the second one is empty unless the range wraps.
+    template<typename T>
+    struct span_pair
+    {
+        const container_range<T>* begin() const { return ranges.data(); }
+        const container_range<T>* end() const { return ranges.data() + ranges.size(); }
+        size_t size() const { return ranges[0].size() + ranges[1].size(); }
+
+        std::array<container_range<T>, 2> ranges;
+    };
+
+    // fill levels since the last reset. each ring records from one side only, the reader's view of the fill
+    // and its underruns, plus the writer's overruns, so no field has two writers.
+    struct ring_stats
+    {
+        static constexpr uint8_t histogram_bins = 8;
+
+        uint32_t min_fill = UINT32_MAX;
+        uint32_t max_fill = 0;
+        uint32_t overruns = 0;
+        uint32_t underruns = 0;
+        // fill in eighths of the logical size.
+        std::array<uint32_t, histogram_bins> histogram = {};
+        bool starving = false;
+    };
+
+#if RING_STATS_ENABLE
+    template<typename Ring> class ring_stats_recorder
+    {
+    public:
+        const ring_stats& get_stats() const { return m_stats; }
+
+        void reset_stats()
+        {
+            m_stats = {};
+        }
+
+        void record_fill(size_t fill)
+        {
+            const size_t size = static_cast<const Ring*>(this)->size();
+            m_stats.min_fill = std::min<uint32_t>(m_stats.min_fill, fill);
+            m_stats.max_fill = std::max<uint32_t>(m_stats.max_fill, fill);
+            if(size)
+                ++m_stats.histogram[std::min<size_t>(fill*ring_stats::histogram_bins/size, ring_stats::histogram_bins - 1)];
+        }
+
+        void record_overrun() { ++m_stats.overruns; }
+
+        // counts each time the reader starts starving, not every poll while it does.
+        void record_underrun(bool starving)
+        {
+            if(starving && !m_stats.starving)
+                ++m_stats.underruns;
+            m_stats.starving = starving;
+        }
+
+    private:
+        ring_stats m_stats;
+    };
+#else
+    template<typename Ring> class ring_stats_recorder
+    {
+    public:
+        void record_fill(size_t) {}
+        void record_overrun() {}
+        void record_underrun(bool) {}
+    };
+#endif
+
+    template<typename Cntr> class circular_buffer : public ring_stats_recorder<circular_buffer<Cntr>>
     {
     public:
         using value_type = typename Cntr::value_type;
@@ -71,7 +157,7 @@ namespace data_structure
         
         size_t capacity() const 
         {
-             return m_container.end() - m_container().begin(); 
+             return m_container.end() - m_container.begin(); 
         }
 
         size_t size() const 
@@ -115,16 +201,18 @@ namespace data_structure
         {
             dbg_assert(start >= begin() && start <= end());
 
+            auto dst = const_cast<pointer_type>(start);
             while(count)
             {
-                const auto n = std::min<size_t>(end() - start, count);
-                start = std::copy(src, src + n, start);
-                if(start == end())
-                    start = begin();
+                const auto n = std::min<size_t>(end() - dst, count);
+                dst = std::copy(src, src + n, dst);
+                src += n;
+                if(dst == end())
+                    dst = begin();
                 count -= n;
             }
 
-            return const_cast<pointer_type>(start);
+            return dst;
         }
 
         pointer_type advance(const_pointer_type limit, const_pointer_type start, size_t count) const
@@ -161,6 +249,18 @@ namespace data_structure
             return const_cast<pointer_type>(start);
         }
 
+        // the data between start and limit in place. the reader moves on with advance(limit, start, count).
+        span_pair<const value_type> readable_spans(const_pointer_type limit, const_pointer_type start) const
+        {
+            dbg_assert(start >= begin() && start <= end());
+            dbg_assert(limit >= begin() && limit <= end());
+
+            if(start > limit)
+                return {{{ {start, end()}, {begin(), limit} }}};
+            else
+                return {{{ {start, limit}, {limit, limit} }}};
+        }
+
         template<typename Fn>
         pointer_type apply_linear(const_pointer_type limit, const_pointer_type start, Fn&& fn)
         {
@@ -185,4 +285,521 @@ namespace data_structure
         Cntr    m_container;
         pointer_type m_end_addr = nullptr;
     };
+
+    // a value handed from one core to the other. store_release() orders the writes before it ahead of the value,
+    // and load_acquire() orders the reads after it behind the value. aligned word loads and stores are atomic on
+    // the rp2040, so a dmb on each side is all it takes there.
+    template<typename T> class published
+    {
+        static_assert(sizeof(T) <= sizeof(uintptr_t), "published value must fit in a word");
+
+    public:
+#if PICO_ON_DEVICE
+        T load_relaxed() const { return m_value; }
+        T load_acquire() const
+        {
+            const T value = m_value;
+            __dmb();
+            return value;
+        }
+        void store_release(T value)
+        {
+            __dmb();
+            m_value = value;
+        }
+
+    private:
+        volatile T m_value{};
+#else
+        T load_relaxed() const { return m_value.load(std::memory_order_relaxed); }
+        T load_acquire() const { return m_value.load(std::memory_order_acquire); }
+        void store_release(T value) { m_value.store(value, std::memory_order_release); }
+
+    private:
+        std::atomic<T> m_value{};
+#endif
+    };
+
+    // orders the loads and stores before it ahead of those after it, for a reader validating a copy.
+    inline void memory_barrier()
+    {
+#if PICO_ON_DEVICE
+        __dmb();
+#else
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    // (write counter, time_us_64) pairs recorded by a ring's writer at commits, at most one per interval. the time an
+    // element was written is interpolated between the pairs around its counter, and the pairs at both ends of the table
+    // give the write rate over its whole span, so a rate or latency estimate costs a copy of the table, not a filter.
+    // a pair tells that everything before its counter had been written at its time.
+    // the writer owns the table, a reader on the other core copies it and retries if the writer lapped the copy.
+    template<size_t Entries> class ring_timestamps
+    {
+        static_assert(Entries >= 2, "interpolation needs two pairs");
+
+    public:
+        using counter_type = uint32_t;
+
+        // the writer must be stopped.
+        void reset()
+        {
+            m_head.store_release(0);
+            m_last_counter = 0;
+            m_last_time_us = 0;
+        }
+
+        void set_interval_us(uint32_t interval_us) { m_interval_us = interval_us; }
+
+        // writer side.
+        void record(counter_type counter)
+        {
+            const auto head = m_head.load_relaxed();
+            if(head && counter == m_last_counter)
+                return;
+
+            const auto now = time_us_64();
+            if(head && now - m_last_time_us < m_interval_us)
+                return;
+
+            m_entries[head % Entries] = {counter, now};
+            m_last_counter = counter;
+            m_last_time_us = now;
+            m_head.store_release(head + 1);
+        }
+
+        // reader side. an element outside the table is extrapolated from the pairs at the nearer end.
+        // false until two pairs have been recorded.
+        bool get_write_time(counter_type counter, uint64_t& time_us) const
+        {
+            std::array<entry, Entries> entries;
+            const auto count = snapshot(entries);
+            if(count < 2)
+                return false;
+
+            size_t i = 0;
+            while(i + 2 < count && int32_t(counter - entries[i + 1].counter) >= 0)
+                ++i;
+
+            const auto &e0 = entries[i];
+            const auto &e1 = entries[i + 1];
+            time_us = e0.time_us + int64_t(int32_t(counter - e0.counter))*int64_t(e1.time_us - e0.time_us)/int32_t(e1.counter - e0.counter);
+            return true;
+        }
+
+        // the elements written over the span of the table and its duration.
+        bool get_write_span(counter_type& elements, uint64_t& duration_us) const
+        {
+            std::array<entry, Entries> entries;
+            const auto count = snapshot(entries);
+            if(count < 2)
+                return false;
+
+            elements = entries[count - 1].counter - entries[0].counter;
+            duration_us = entries[count - 1].time_us - entries[0].time_us;
+            return duration_us > 0;
+        }
+
+        // elements per second over the span of the table, 0 until known.
+        uint32_t get_write_rate() const
+        {
+            counter_type elements;
+            uint64_t duration_us;
+            if(!get_write_span(elements, duration_us))
+                return 0;
+            return uint64_t(elements)*1000000/duration_us;
+        }
+
+    private:
+        struct entry
+        {
+            counter_type counter;
+            uint64_t time_us;
+        };
+
+        std::array<entry, Entries> m_entries;
+        published<uint32_t> m_head;
+        counter_type m_last_counter = 0;
+        uint64_t m_last_time_us = 0;
+        uint32_t m_interval_us = 0;
+
+        // the recorded pairs oldest first. the slot at the head may be in rewrite, so one less than the table is taken.
+        size_t snapshot(std::array<entry, Entries>& entries) const
+        {
+            for(;;)
+            {
+                const auto head = m_head.load_acquire();
+                const auto count = std::min<uint32_t>(head, Entries - 1);
+                const auto first = head - count;
+                for(size_t i = 0; i < count; ++i)
+                    entries[i] = m_entries[(first + i) % Entries];
+
+                memory_barrier();
+                if(m_head.load_relaxed() - first < Entries)
+                    return count;
+            }
+        }
+    };
+
+    // rings without timestamps keep no table.
+    template<> class ring_timestamps<0>
+    {
+    public:
+        void reset() {}
+        void record(uint32_t) {}
+    };
+
+    // one writer and up to Readers readers sharing a circular_buffer, each with its own cursor. a cursor is the address
+    // its side works at plus a free running counter published to the other side. the writer gets the free space against
+    // the slowest attached reader in O(readers), and each reader its lag, which also tells when it has been lapped.
+    // the writer never waits for a reader, a lapped reader resyncs itself.
+    // with Timestamps the writer records its commits in a ring_timestamps table of that many pairs.
+    template<typename Cntr, uint8_t Readers, size_t Timestamps = 0> class multi_reader_circular_buffer : public circular_buffer<Cntr>
+    {
+        using base = circular_buffer<Cntr>;
+
+    public:
+        using typename base::value_type;
+        using typename base::pointer_type;
+        using typename base::const_pointer_type;
+        using counter_type = uint32_t;
+
+        // both sides must be stopped.
+        void resize(size_t count)
+        {
+            base::resize(count);
+            reset();
+        }
+
+        void reset()
+        {
+            m_write_addr.store_release(base::begin());
+            m_write_counter.store_release(0);
+            for(auto &cursor : m_readers)
+            {
+                cursor.addr = base::begin();
+                cursor.counter.store_release(0);
+            }
+            m_timestamps.reset();
+        }
+
+        // writer side.
+        pointer_type get_write_addr() const { return m_write_addr.load_relaxed(); }
+        counter_type get_write_counter() const { return m_write_counter.load_acquire(); }
+
+        // the address and the counter change together under an odd sequence, so a reader can take both as one pair.
+        void commit_write(size_t count)
+        {
+            const auto sequence = m_write_sequence.load_relaxed();
+            const auto counter = m_write_counter.load_relaxed() + count;
+            m_write_sequence.store_release(sequence + 1);
+            memory_barrier();
+            m_write_addr.store_release(base::advance(m_write_addr.load_relaxed(), count));
+            m_write_counter.store_release(counter);
+            m_write_sequence.store_release(sequence + 2);
+            m_timestamps.record(counter);
+        }
+
+        // with the writer stopped.
+        void set_timestamp_interval_us(uint32_t interval_us) { m_timestamps.set_interval_us(interval_us); }
+        const ring_timestamps<Timestamps>& get_timestamps() const { return m_timestamps; }
+
+        size_t available() const
+        {
+            const auto counter = m_write_counter.load_relaxed();
+            size_t max_lag = 0;
+            for(const auto &cursor : m_readers)
+            {
+                if(cursor.attached.load_acquire())
+                    max_lag = std::max<size_t>(max_lag, counter_type(counter - cursor.counter.load_acquire()));
+            }
+            return max_lag < base::size() ? base::size() - max_lag : 0;
+        }
+
+        // reader side. only attached readers count for available(), a reader attaches keep elements behind the writer.
+        void attach_reader(uint8_t reader, size_t keep)
+        {
+            resync(reader, keep);
+            m_readers[reader].attached.store_release(true);
+        }
+
+        void detach_reader(uint8_t reader)
+        {
+            m_readers[reader].attached.store_release(false);
+        }
+
+        size_t lag(uint8_t reader) const
+        {
+            return counter_type(m_write_counter.load_acquire() - m_readers[reader].counter.load_relaxed());
+        }
+
+        // at the full size the writer is already overwriting what the reader would take next.
+        bool is_lapped(uint8_t reader) const { return lag(reader) >= base::size(); }
+
+        // skips to keep elements behind the writer, returns the count skipped. the cursor is placed from the writer's
+        // position, not moved by the lag, so it lines up again even when the lag has wrapped the counters.
+        size_t resync(uint8_t reader, size_t keep)
+        {
+            dbg_assert(keep < base::size());
+            auto &cursor = m_readers[reader];
+            const auto position = load_write_position();
+            const size_t reader_lag = counter_type(position.counter - cursor.counter.load_relaxed());
+            const auto behind = std::min(reader_lag, keep);
+            cursor.addr = behind ? base::advance(position.addr, base::size() - behind) : position.addr;
+            cursor.counter.store_release(position.counter - behind);
+            return reader_lag - behind;
+        }
+
+        const_pointer_type get_read_addr(uint8_t reader) const { return m_readers[reader].addr; }
+        counter_type get_read_counter(uint8_t reader) const { return m_readers[reader].counter.load_relaxed(); }
+
+        // up to count elements of the lag in place.
+        span_pair<const value_type> readable_spans(uint8_t reader, size_t count) const
+        {
+            const auto &cursor = m_readers[reader];
+            count = std::min(count, lag(reader));
+            return base::readable_spans(base::advance(cursor.addr, count), cursor.addr);
+        }
+
+        template<typename Fn>
+        size_t apply_linear(uint8_t reader, Fn&& fn)
+        {
+            auto &cursor = m_readers[reader];
+            const auto limit = base::advance(cursor.addr, lag(reader));
+            const auto addr = base::apply_linear(limit, cursor.addr, fn);
+            const auto consumed = base::distance(addr, cursor.addr);
+            commit_read(reader, consumed);
+            return consumed;
+        }
+
+        void commit_read(uint8_t reader, size_t count)
+        {
+            auto &cursor = m_readers[reader];
+            // a lapped reader may skip more than the whole ring.
+            cursor.addr = base::advance(cursor.addr, count < base::size() ? count : count % base::size());
+            cursor.counter.store_release(cursor.counter.load_relaxed() + count);
+        }
+
+    private:
+        struct cursor
+        {
+            const_pointer_type addr = nullptr;
+            published<counter_type> counter;
+            published<bool> attached;
+        };
+
+        struct write_position
+        {
+            pointer_type addr;
+            counter_type counter;
+        };
+
+        // retries while a commit is in progress.
+        write_position load_write_position() const
+        {
+            while(true)
+            {
+                const auto sequence = m_write_sequence.load_acquire();
+                const write_position position = { m_write_addr.load_relaxed(), m_write_counter.load_relaxed() };
+                memory_barrier();
+                if(!(sequence & 1) && m_write_sequence.load_relaxed() == sequence)
+                    return position;
+            }
+        }
+
+        published<pointer_type> m_write_addr;
+        published<counter_type> m_write_counter;
+        published<uint32_t> m_write_sequence;
+        std::array<cursor, Readers> m_readers;
+        ring_timestamps<Timestamps> m_timestamps;
+    };
+
+    constexpr size_t round_up_pow2(size_t value)
+    {
+        size_t result = 1;
+        while(result < value)
+            result <<= 1;
+        return result;
+    }
+
+    // power of two capacity ring with free running read/write counters. the fill level is a subtraction and
+    // a counter becomes an index by masking, so neither needs a wrap branch. the logical size set by resize()
+    // follows the sampling frequency and only limits the fill level, the storage keeps the full capacity.
+    // one producer and one consumer, on either core. each side owns its counter and publishes it with release
+    // after touching the data, and loads the other side's counter with acquire.
+    // with a Guard tail the first Guard elements are mirrored past end() by commit_write(), so a reader gets up to
+    // Guard elements in one piece across the seam.
+    // with Timestamps the writer records its commits in a ring_timestamps table of that many pairs.
+    template<typename T, size_t N, size_t Guard = 0, size_t Timestamps = 0> class masked_circular_buffer : public ring_stats_recorder<masked_circular_buffer<T, N, Guard, Timestamps>>
+    {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+        static_assert(Guard <= N, "guard tail must not exceed the capacity");
+
+    public:
+        using value_type = T;
+        using pointer_type = value_type*;
+        using const_pointer_type = const value_type*;
+        using counter_type = uint32_t;
+
+        static constexpr counter_type mask = N - 1;
+
+        pointer_type begin() { return m_buffer.begin(); }
+        pointer_type end() { return m_buffer.begin() + N; }
+        const_pointer_type begin() const { return m_buffer.begin(); }
+        const_pointer_type end() const { return m_buffer.begin() + N; }
+
+        pointer_type at(counter_type counter) { return begin() + (counter & mask); }
+        const_pointer_type at(counter_type counter) const { return begin() + (counter & mask); }
+
+        constexpr size_t capacity() const { return N; }
+        size_t size() const { return m_limit; }
+
+        // both sides must be stopped.
+        void resize(size_t count)
+        {
+            dbg_assert(count <= N);
+            m_limit = count;
+            reset();
+        }
+
+        void reset()
+        {
+            m_read.store_release(0);
+            m_write.store_release(0);
+            m_timestamps.reset();
+        }
+
+        counter_type get_read_counter() const { return m_read.load_acquire(); }
+        counter_type get_write_counter() const { return m_write.load_acquire(); }
+
+        // exact on the owning side, a lower bound of what the owner will see on the other side.
+        size_t used() const { return m_write.load_acquire() - m_read.load_acquire(); }
+        size_t available() const { return m_limit - used(); }
+
+        // writer side. the free space in place, filled directly and then handed over with commit_write().
+        span_pair<value_type> writable_spans()
+        {
+            const auto counter = m_write.load_relaxed();
+            return get_spans(counter, m_limit - size_t(counter - m_read.load_acquire()));
+        }
+
+        void commit_write(size_t count)
+        {
+            const auto counter = m_write.load_relaxed();
+            dbg_assert(count <= m_limit - size_t(counter - m_read.load_relaxed()));
+            if constexpr (Guard > 0)
+                mirror_guard(counter, count);
+            m_write.store_release(counter + count);
+            m_timestamps.record(counter + count);
+        }
+
+        // with the writer stopped.
+        void set_timestamp_interval_us(uint32_t interval_us) { m_timestamps.set_interval_us(interval_us); }
+        const ring_timestamps<Timestamps>& get_timestamps() const { return m_timestamps; }
+
+        // reader side. the stored data in place, consumed directly and then released with commit_read().
+        span_pair<const value_type> readable_spans()
+        {
+            const auto counter = m_read.load_relaxed();
+            const auto spans = get_spans(counter, m_write.load_acquire() - counter);
+            return {{{ {spans.ranges[0].begin(), spans.ranges[0].end()}, {spans.ranges[1].begin(), spans.ranges[1].end()} }}};
+        }
+
+        // up to count stored elements in one piece. it runs on over the seam into the guard tail, so any count up to
+        // Guard comes back whole while that much is stored.
+        container_range<const value_type> readable_span(size_t count)
+        {
+            const auto counter = m_read.load_relaxed();
+            const auto offset = counter & mask;
+            count = std::min({count, size_t(m_write.load_acquire() - counter), N + Guard - offset});
+            return {begin() + offset, begin() + offset + count};
+        }
+
+        // fn(begin, end) consumes from the stored data and returns the count consumed, like circular_buffer::apply_linear().
+        // a piece consumed up to the guard tail moves on across the seam, so items up to Guard long are never split.
+        template<typename Fn>
+        size_t apply_linear(Fn&& fn)
+        {
+            auto counter = m_read.load_relaxed();
+            auto remain = size_t(m_write.load_acquire() - counter);
+            size_t consumed_count = 0;
+            while(remain)
+            {
+                const auto offset = counter & mask;
+                const auto n = std::min<size_t>(N + Guard - offset, remain);
+                const size_t consumed = fn(begin() + offset, begin() + offset + n);
+                dbg_assert(consumed <= n);
+                counter += consumed;
+                remain -= consumed;
+                consumed_count += consumed;
+                if(consumed == 0 || (consumed < n && offset + consumed < N))
+                    break;
+            }
+
+            m_read.store_release(counter);
+            return consumed_count;
+        }
+
+        void commit_read(size_t count)
+        {
+            const auto counter = m_read.load_relaxed();
+            dbg_assert(count <= size_t(m_write.load_relaxed() - counter));
+            m_read.store_release(counter + count);
+        }
+
+        // returns the number of elements written, which is short when the fill limit is reached.
+        size_t write(const_pointer_type src, size_t count)
+        {
+            size_t written = 0;
+            for(const auto &span : writable_spans())
+            {
+                const auto n = std::min(span.size(), count - written);
+                std::copy(src + written, src + written + n, span.begin());
+                written += n;
+            }
+
+            commit_write(written);
+            return written;
+        }
+
+        // returns the number of elements read, which is short when the ring runs dry.
+        size_t read(pointer_type dst, size_t count)
+        {
+            size_t read_count = 0;
+            for(const auto &span : readable_spans())
+            {
+                const auto n = std::min(span.size(), count - read_count);
+                dst = std::copy(span.begin(), span.begin() + n, dst);
+                read_count += n;
+            }
+
+            commit_read(read_count);
+            return read_count;
+        }
+
+    private:
+        std::array<T, N + Guard> m_buffer;
+        published<counter_type> m_read;
+        published<counter_type> m_write;
+        size_t m_limit = N;
+        ring_timestamps<Timestamps> m_timestamps;
+
+        void mirror_guard(counter_type counter, size_t count)
+        {
+            const auto offset = counter & mask;
+            const auto first = std::min<size_t>(N - offset, count);
+            if(offset < Guard)
+                std::copy(begin() + offset, begin() + std::min<size_t>(offset + first, Guard), begin() + N + offset);
+            const auto second = std::min<size_t>(count - first, Guard);
+            std::copy(begin(), begin() + second, begin() + N);
+        }
+
+        span_pair<value_type> get_spans(counter_type counter, size_t count)
+        {
+            const auto offset = counter & mask;
+            const auto first = std::min<size_t>(N - offset, count);
+            return {{{ {begin() + offset, begin() + offset + first}, {begin(), begin() + (count - first)} }}};
+        }
+    };
 }
\ No newline at end of file
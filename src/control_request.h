@@ -5,6 +5,36 @@ enum
     CONTROL_SPDIF_IN_SET_VOLUME = 1,
     CONTROL_SPDIF_IN_GET_VOLUME,
     CONTROL_LINE_IN_SET_VOLUME,
-    CONTROL_LINE_IN_GET_VOLUME
+    CONTROL_LINE_IN_GET_VOLUME,
+    CONTROL_SPDIF_IN_SET_VOLUME_DB,
+    CONTROL_SPDIF_IN_GET_VOLUME_DB,
+    CONTROL_LINE_IN_SET_VOLUME_DB,
+    CONTROL_LINE_IN_GET_VOLUME_DB,
+    CONTROL_LEVEL_METER_SET_ENABLE,
+    CONTROL_LEVEL_METER_GET_ENABLE,
+    CONTROL_LEVEL_METER_GET_VALUES,
+    CONTROL_LIMITER_SET_ENABLE,
+    CONTROL_LIMITER_GET_ENABLE,
+    CONTROL_ROUTE_SET_VOLUME_DB,
+    CONTROL_ROUTE_GET_VOLUME_DB,
+    CONTROL_TRANSITION_SET_FRAMES,
+    CONTROL_TRANSITION_GET_FRAMES,
+    CONTROL_OUTPUT_EQ_SET_SECTIONS,
+    CONTROL_OUTPUT_EQ_GET_SECTIONS,
+    CONTROL_LINE_IN_DYNAMICS_SET_ENABLE,
+    CONTROL_LINE_IN_DYNAMICS_GET_ENABLE,
+    CONTROL_LINE_IN_DYNAMICS_SET_PARAMETERS,
+    CONTROL_LINE_IN_DYNAMICS_GET_PARAMETERS,
+    CONTROL_LINE_IN_DYNAMICS_GET_GAIN_DB,
+    CONTROL_SPECTRUM_SET_ENABLE,
+    CONTROL_SPECTRUM_GET_ENABLE,
+    CONTROL_SPECTRUM_SET_SOURCE,
+    CONTROL_SPECTRUM_GET_SOURCE,
+    CONTROL_SPECTRUM_SET_POINTS,
+    CONTROL_SPECTRUM_GET_POINTS,
+    CONTROL_SPECTRUM_GET_BINS,
+    CONTROL_JOB_GET_STATS,
+    CONTROL_JOB_GET_NAME,
+    CONTROL_OUTPUT_EQ_GET_MAX_SECTIONS
 };
 
@@ -451,6 +451,7 @@ namespace processing
         }
 
         std::memset(m_ch_state, 0, sizeof(m_ch_state));
+        m_skip_steps = 0;
 
         if(m_step > 0xff)
         {
@@ -496,6 +497,22 @@ namespace processing
         return total_result;
     }
 
+    size_t converter::skip(size_t src_bytes, size_t dst_bytes)
+    {
+        const auto src_stride = m_config.src_stride*m_config.channels;
+        const auto dst_stride = m_config.dst_stride*m_config.channels;
+
+        // keep the fraction so that skipping doesn't drift against the writer.
+        const uint32_t steps = m_skip_steps + dst_bytes/dst_stride*m_step;
+        const size_t frames = std::min<size_t>(steps >> 8, src_bytes/src_stride);
+        m_skip_steps = steps & 0xff;
+
+        // the next apply() starts from its first sample again.
+        std::memset(m_ch_state, 0, sizeof(m_ch_state));
+
+        return frames*src_stride;
+    }
+
     uint32_t converter::get_requirement_src_samples(uint32_t dst_samples) const
     {
         if(dst_samples == 0)
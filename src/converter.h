@@ -30,6 +30,8 @@ public:
     void setup(const config &);
 
     apply_result apply(const uint8_t *src_begin, const uint8_t *src_end, uint8_t *dst_begin, uint8_t *dst_end);
+    // consume the source as if dst_bytes of silence were produced. returns the source bytes to skip.
+    size_t skip(size_t src_bytes, size_t dst_bytes);
     uint32_t get_requirement_src_samples(uint32_t dst_samples) const;
     uint32_t get_requirement_src_bytes(uint32_t dst_bytes) const;
 
@@ -43,6 +45,7 @@ private:
     interp_config m_lane0;
     interp_config m_lane1;
     uint32_t m_step;
+    uint32_t m_skip_steps;
     struct {
         uint32_t count;
         uint32_t base0;
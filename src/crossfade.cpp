@@ -0,0 +1,119 @@
+#include <pico/platform.h>
+#include <array>
+#include <algorithm>
+#include "support.h"
+#include "debug.h"
+#include "crossfade.h"
+
+namespace processing
+{
+    using namespace support;
+
+
+    constexpr double constexpr_sin(double x)
+    {
+        double sum = 0.0;
+        double term = x;
+        for(int i = 1; i < 16; ++i)
+        {
+            sum += term;
+            term *= -x*x/((2*i)*(2*i + 1));
+        }
+        return sum;
+    }
+
+    // quarter sine in Q1.15. the incoming gain walks up the table and the outgoing gain walks down.
+    constexpr size_t fade_table_steps = 64;
+    constexpr auto g_fade_table = []()
+    {
+        constexpr double half_pi = 1.5707963267948966;
+        std::array<uint16_t, fade_table_steps + 1> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+            table[i] = (uint16_t)(constexpr_sin(half_pi*i/fade_table_steps)*0x8000 + 0.5);
+        return table;
+    }();
+
+    static_assert(g_fade_table[0] == 0);
+    static_assert(g_fade_table[fade_table_steps] == 0x8000);
+
+    // phase is the table position in Q16.
+    constexpr uint32_t fade_phase_end = fade_table_steps << 16;
+
+    static inline uint16_t get_fade_gain(uint32_t phase)
+    {
+        const uint32_t index = phase >> 16;
+        if(index >= fade_table_steps)
+            return g_fade_table[fade_table_steps];
+
+        const uint32_t g0 = g_fade_table[index];
+        const uint32_t g1 = g_fade_table[index + 1];
+        return g0 + (((g1 - g0)*(phase & 0xffff)) >> 16);
+    }
+
+    template<uint8_t Bits> static inline uint32_t saturate_blend(int64_t value)
+    {
+        constexpr int64_t max_value = ((int64_t)1 << (Bits - 1)) - 1;
+        constexpr int64_t min_value = -((int64_t)1 << (Bits - 1));
+        return (uint32_t)std::clamp(value, min_value, max_value);
+    }
+
+    template<uint8_t Bits>
+    size_t crossfade::blend(const int32_t* outgoing, uint32_t outgoing_frames, uint8_t* dst_begin, uint8_t* dst_end)
+    {
+        const auto stride = m_config.stride;
+        const uint8_t channels = m_config.channels;
+        const auto frame_stride = stride*channels;
+
+        auto dst = dst_begin;
+        while(m_position < m_frames && dst + frame_stride <= dst_end)
+        {
+            const uint32_t phase = m_position*m_phase_step;
+            const int64_t in_gain = get_fade_gain(phase);
+            const int64_t out_gain = get_fade_gain(fade_phase_end - phase);
+
+            const int32_t* out = m_position < outgoing_frames ? outgoing + m_position*channels : nullptr;
+            for(uint8_t ch = 0; ch < channels; ++ch)
+            {
+                int64_t value = (int32_t)bytes_to_dword<Bits, true>(dst)*in_gain;
+                if(out)
+                    value += (out[ch] >> (32 - Bits))*out_gain;
+                copy_dword<Bits>(dst, saturate_blend<Bits>(value >> 15));
+                dst += stride;
+            }
+            ++m_position;
+        }
+
+        return dst - dst_begin;
+    }
+
+    void crossfade::setup(const config& cfg)
+    {
+        m_config = cfg;
+
+        switch(cfg.bits)
+        {
+            case 16: m_fn_blend = &crossfade::blend<16>; break;
+            case 20: m_fn_blend = &crossfade::blend<20>; break;
+            case 24: m_fn_blend = &crossfade::blend<24>; break;
+            case 32: m_fn_blend = &crossfade::blend<32>; break;
+            default:
+                dbg_assert(false && "unsupproted bits");
+        }
+    }
+
+    void crossfade::start(uint32_t frames)
+    {
+        m_frames = frames;
+        m_position = 0;
+        m_phase_step = frames ? fade_phase_end/frames : 0;
+    }
+
+    size_t crossfade::apply(const int32_t* outgoing, uint32_t outgoing_frames, uint8_t* dst_begin, uint8_t* dst_end)
+    {
+        if(!is_active() || !m_fn_blend)
+            return 0;
+
+        return (this->*m_fn_blend)(outgoing, outgoing_frames, dst_begin, dst_end);
+    }
+
+}
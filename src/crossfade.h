@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace processing
+{
+
+// blends an outgoing stream into the incoming one over a number of frames with an equal power curve.
+class crossfade
+{
+public:
+    struct config
+    {
+        uint8_t bits;
+        uint8_t stride;
+        uint8_t channels;
+    };
+
+    void setup(const config&);
+    void start(uint32_t frames);
+    void stop() { m_frames = 0; m_position = 0; }
+    bool is_active() const { return m_position < m_frames; }
+
+    // outgoing holds left aligned 32bit samples per frame from the start of the fade, and is silence after outgoing_frames.
+    // the incoming stream in dst is overwritten with the blend. returns the bytes of dst still inside the fade.
+    size_t apply(const int32_t* outgoing, uint32_t outgoing_frames, uint8_t* dst_begin, uint8_t* dst_end);
+
+private:
+    using fn_blend_t = size_t(crossfade::*)(const int32_t* outgoing, uint32_t outgoing_frames, uint8_t* dst_begin, uint8_t* dst_end);
+
+    config m_config;
+    uint32_t m_frames = 0;
+    uint32_t m_position = 0;
+    uint32_t m_phase_step = 0;
+    fn_blend_t m_fn_blend = nullptr;
+
+    template<uint8_t Bits>
+        size_t blend(const int32_t* outgoing, uint32_t outgoing_frames, uint8_t* dst_begin, uint8_t* dst_end);
+};
+
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "usb_config.h"
+#if !PICO_ON_DEVICE
+#include <stdlib.h>
+#endif
 
 #ifdef __cplusplus
 extern "C"{
@@ -23,8 +26,12 @@ void dbg_flush_cdc();
 #endif
 
 #if DBG_ASSERT_ENABLE
+#if PICO_ON_DEVICE
 inline void dbg_assert(bool cond) { while(!cond) __breakpoint();  }
 #else
+inline void dbg_assert(bool cond) { if(!cond) abort(); }
+#endif
+#else
 inline void dbg_assert(bool cond) {}
 #endif
 
@@ -51,6 +51,12 @@ std::array<uint8_t, ITF_NUM_AUDIO_TOTAL> g_current_resolutions;
 debug_stats g_debug_stats;
 #endif
 
+// driven by the tinyusb event queue, see tud_event_hook_cb().
+job_queue::work_fn g_usb_job;
+data_structure::published<bool> g_usb_event_queued;
+// only a fallback, in case an event is queued without the hook.
+constexpr uint32_t usb_job_poll_interval_us = 1000;
+
 void core1_loop();
 void debug_cdc_job(job_queue::work*);
 void tud_update_job(job_queue::work*);
@@ -86,6 +92,9 @@ int main(void)
 
     systick_hw->csr = 0b101;
 
+    // the usb irq makes the usb job pending from the first bus event.
+    job_queue::system::init();
+
     tusb_init();
 
     if(tusb_pico_reserve_buffer)
@@ -113,8 +122,6 @@ int main(void)
     dbg_print_init();
 #endif
 
-    job_queue::system::init();
-
     PROFILE_INITIALIZE(2, MAX_MEASUREMENT);
     PROFILE_CREATE_GROUP("core0");
     PROFILE_CREATE_GROUP("core1");
@@ -126,31 +133,30 @@ int main(void)
     const uint8_t core0mask = (1 << 0);
     const uint8_t core1mask = (1 << 1);
 
-    static job_queue::work_fn usb_job;
-    usb_job.set_affinity_mask(core0mask|core1mask);
-    usb_job.set_callback(tud_update_job);
-    usb_job.activate();
-    usb_job.set_pending();
+    g_usb_job.set_affinity_mask(core0mask|core1mask);
+    g_usb_job.set_callback(tud_update_job);
+    g_usb_job.set_name("usb");
+    g_usb_job.activate();
+    g_usb_job.set_pending();
 
 #if USB_IF_DEBUG_CDC_ENABLE
     static job_queue::work_fn debug_cdc;
     debug_cdc.set_affinity_mask(core0mask|core1mask);
     debug_cdc.set_callback(debug_cdc_job);
+    debug_cdc.set_name("debug cdc");
     debug_cdc.activate();
     debug_cdc.set_pending();
 #endif
 
     multicore_launch_core1(core1_loop);
-    while (true)
-        job_queue::system::execute();
+    job_queue::system::run();
 
     return 0;
 }
 
 void core1_loop()
 {
-    while(true)
-        job_queue::system::execute();
+    job_queue::system::run();
 }
 
 //--------------------------------------------------------------------+
@@ -179,6 +185,13 @@ void tud_resume_cb(void)
 {
 }
 
+// Invoked when an event is queued, from the usb irq or from tinyusb itself.
+void tud_event_hook_cb(uint8_t rhport, uint32_t eventid, bool in_isr)
+{
+    g_usb_event_queued.store_release(true);
+    g_usb_job.set_pending();
+}
+
 #if USB_IF_AUDIO_ENABLE
 
 // Helper for clock get requests
@@ -454,6 +467,15 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
 bool device_control_request(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
 {
     static uint8_t data;
+    static int16_t data_db;
+    static uint16_t data_u16;
+    static std::array<streaming::eq_section, streaming::max_output_eq_sections> eq_sections;
+    static streaming::dynamics_parameters dynamics_params;
+    static std::array<int16_t, 512> spectrum_bins;
+#if JOB_STATS_ENABLE
+    static job_queue::job_stats job_stats;
+#endif
+    static std::array<streaming::level_meter_value, streaming::LEVEL_METER_SOURCE_NUM*device_input_channels> level_meters;
 
     switch(request->wIndex)
     {
@@ -497,6 +519,303 @@ bool device_control_request(uint8_t rhport, uint8_t stage, tusb_control_request_
                 return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
             }
             break;
+        case CONTROL_SPDIF_IN_SET_VOLUME_DB:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spdif in set volume db\n");
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data_db);
+                streaming::set_spdif_in_volume_db(data_db);
+            }
+            break;
+        case CONTROL_SPDIF_IN_GET_VOLUME_DB:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spdif in get volume db\n");
+                data_db = streaming::get_spdif_in_volume_db();
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            break;
+        case CONTROL_LINE_IN_SET_VOLUME_DB:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in set volume db\n");
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data_db);
+                streaming::set_line_in_volume_db(data_db);
+            }
+            break;
+        case CONTROL_LINE_IN_GET_VOLUME_DB:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in get volume db\n");
+                data_db = streaming::get_line_in_volume_db();
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            break;
+        case CONTROL_LEVEL_METER_SET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor level meter set enable\n");
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data);
+                streaming::set_level_meter_enabled(data != 0);
+            }
+            break;
+        case CONTROL_LEVEL_METER_GET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor level meter get enable\n");
+                data = streaming::is_level_meter_enabled() ? 1 : 0;
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            break;
+        case CONTROL_LEVEL_METER_GET_VALUES:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                // sources x channels of { peak, peak hold, rms }
+                for (uint8_t source = 0; source < streaming::LEVEL_METER_SOURCE_NUM; ++source)
+                    for (uint8_t ch = 0; ch < device_input_channels; ++ch)
+                        level_meters[source*device_input_channels + ch] = streaming::get_level_meter(source, ch);
+                return tud_control_xfer(rhport, request, level_meters.data(), sizeof(level_meters));
+            }
+            break;
+        case CONTROL_LIMITER_SET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor limiter set enable\n");
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data);
+                streaming::set_limiter_enabled(data != 0);
+            }
+            break;
+        case CONTROL_LIMITER_GET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor limiter get enable\n");
+                data = streaming::is_limiter_enabled() ? 1 : 0;
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            break;
+        case CONTROL_ROUTE_SET_VOLUME_DB:
+            // wValue: source << 8 | sink
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor route set volume db %d %d\n", tu_u16_high(request->wValue), tu_u16_low(request->wValue));
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data_db);
+                streaming::set_route_volume_db(tu_u16_high(request->wValue), tu_u16_low(request->wValue), data_db);
+            }
+            break;
+        case CONTROL_ROUTE_GET_VOLUME_DB:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor route get volume db %d %d\n", tu_u16_high(request->wValue), tu_u16_low(request->wValue));
+                data_db = streaming::get_route_volume_db(tu_u16_high(request->wValue), tu_u16_low(request->wValue));
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            break;
+        case CONTROL_TRANSITION_SET_FRAMES:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor transition set frames\n");
+                return tud_control_xfer(rhport, request, &data_u16, sizeof(uint16_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data_u16);
+                streaming::set_transition_frames(data_u16);
+            }
+            break;
+        case CONTROL_TRANSITION_GET_FRAMES:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor transition get frames\n");
+                data_u16 = streaming::get_transition_frames();
+                return tud_control_xfer(rhport, request, &data_u16, sizeof(uint16_t));
+            }
+            break;
+        case CONTROL_OUTPUT_EQ_SET_SECTIONS:
+            // wValue: number of sections
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor output eq set sections %d\n", request->wValue);
+                if (request->wValue > eq_sections.size())
+                    return false;
+                return tud_control_xfer(rhport, request, eq_sections.data(), request->wValue * sizeof(streaming::eq_section));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                streaming::set_output_eq(eq_sections.data(), request->wValue);
+            }
+            break;
+        case CONTROL_OUTPUT_EQ_GET_SECTIONS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor output eq get sections\n");
+                const auto count = streaming::get_output_eq(eq_sections.data(), eq_sections.size());
+                return tud_control_xfer(rhport, request, eq_sections.data(), count * sizeof(streaming::eq_section));
+            }
+            break;
+        case CONTROL_OUTPUT_EQ_GET_MAX_SECTIONS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor output eq get max sections\n");
+                data = streaming::get_output_eq_max_sections();
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            break;
+        case CONTROL_LINE_IN_DYNAMICS_SET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in dynamics set enable\n");
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data);
+                streaming::set_line_in_dynamics_enabled(data != 0);
+            }
+            break;
+        case CONTROL_LINE_IN_DYNAMICS_GET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in dynamics get enable\n");
+                data = streaming::is_line_in_dynamics_enabled() ? 1 : 0;
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            break;
+        case CONTROL_LINE_IN_DYNAMICS_SET_PARAMETERS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in dynamics set parameters\n");
+                return tud_control_xfer(rhport, request, &dynamics_params, sizeof(dynamics_params));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                streaming::set_line_in_dynamics(dynamics_params);
+            }
+            break;
+        case CONTROL_LINE_IN_DYNAMICS_GET_PARAMETERS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in dynamics get parameters\n");
+                dynamics_params = streaming::get_line_in_dynamics();
+                return tud_control_xfer(rhport, request, &dynamics_params, sizeof(dynamics_params));
+            }
+            break;
+        case CONTROL_LINE_IN_DYNAMICS_GET_GAIN_DB:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor line in dynamics get gain db\n");
+                data_db = streaming::get_line_in_dynamics_gain_db();
+                return tud_control_xfer(rhport, request, &data_db, sizeof(int16_t));
+            }
+            break;
+        case CONTROL_SPECTRUM_SET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spectrum set enable\n");
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data);
+                streaming::set_spectrum_enabled(data != 0);
+            }
+            break;
+        case CONTROL_SPECTRUM_GET_ENABLE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spectrum get enable\n");
+                data = streaming::is_spectrum_enabled() ? 1 : 0;
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            break;
+        case CONTROL_SPECTRUM_SET_SOURCE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spectrum set source\n");
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data);
+                streaming::set_spectrum_source(data);
+            }
+            break;
+        case CONTROL_SPECTRUM_GET_SOURCE:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spectrum get source\n");
+                data = streaming::get_spectrum_source();
+                return tud_control_xfer(rhport, request, &data, sizeof(uint8_t));
+            }
+            break;
+        case CONTROL_SPECTRUM_SET_POINTS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spectrum set points\n");
+                return tud_control_xfer(rhport, request, &data_u16, sizeof(uint16_t));
+            }
+            else if (stage == CONTROL_STAGE_DATA)
+            {
+                DEVICE_LOG("value %d\n", data_u16);
+                streaming::set_spectrum_points(data_u16);
+            }
+            break;
+        case CONTROL_SPECTRUM_GET_POINTS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                DEVICE_LOG("vendor spectrum get points\n");
+                data_u16 = streaming::get_spectrum_points();
+                return tud_control_xfer(rhport, request, &data_u16, sizeof(uint16_t));
+            }
+            break;
+        case CONTROL_SPECTRUM_GET_BINS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                const auto count = streaming::get_spectrum(spectrum_bins.data(), spectrum_bins.size());
+                return tud_control_xfer(rhport, request, spectrum_bins.data(), count * sizeof(int16_t));
+            }
+            break;
+#if JOB_STATS_ENABLE
+        case CONTROL_JOB_GET_STATS:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                // wValue is the job index, a stall past the last job ends the enumeration.
+                const auto job = job_queue::system::get_job(request->wValue);
+                if(!job)
+                    return false;
+                job_stats = job->get_stats();
+                return tud_control_xfer(rhport, request, &job_stats, sizeof(job_stats));
+            }
+            break;
+        case CONTROL_JOB_GET_NAME:
+            if (stage == CONTROL_STAGE_SETUP)
+            {
+                const auto job = job_queue::system::get_job(request->wValue);
+                if(!job)
+                    return false;
+                return tud_control_xfer(rhport, request, const_cast<char*>(job->get_name()), strlen(job->get_name()));
+            }
+            break;
+#endif
 
         default:
             return false;
@@ -513,11 +832,17 @@ bool device_control_request(uint8_t rhport, uint8_t stage, tusb_control_request_
 
 void tud_update_job(job_queue::work *job)
 {
+    g_usb_event_queued.store_release(false);
+
     PROFILE_MEASURE_BEGIN(PERF_TUD_TASK);
     tud_task(); // tinyusb device task
     PROFILE_MEASURE_END();
 
-    job->set_pending();
+    // the fallback poll would push back the pending from an event queued meanwhile, so that one is made pending again.
+    // an event after the check makes the job pending on its own.
+    job->set_pending_delay_us(usb_job_poll_interval_us);
+    if(g_usb_event_queued.load_acquire())
+        job->set_pending();
 }
 
 #if PRINT_STATS
@@ -526,6 +851,11 @@ void print_debug_stats()
     dbg_printf("stats:\n");
     dbg_printf("  time: %f\n", time_us_64()/1000000.);
     dbg_printf("  fb: %u  freq: %u\n", g_debug_stats.fb, g_debug_stats.fb_freq);
+    dbg_printf("  jobs:\n    deadline misses: %u\n", job_queue::system::get_deadline_misses());
+    dbg_printf("    idle: core0 %f  core1 %f\n", job_queue::system::get_idle_us(0)/1000000., job_queue::system::get_idle_us(1)/1000000.);
+#if JOB_STATS_ENABLE
+    job_queue::system::print_stats();
+#endif
     streaming::print_debug_stats();
 }
 #endif
@@ -0,0 +1,167 @@
+#include <pico/platform.h>
+#include <algorithm>
+#include "support.h"
+#include "debug.h"
+#include "mixer.h"
+#include "dynamics.h"
+
+namespace processing
+{
+    using namespace support;
+
+    // 20*log10(2) in 1/256 dB
+    constexpr int16_t doubling_db = 1541;
+
+    // mixer::db_to_gain reaches +6dB. larger gains are doubled per 6.02dB.
+    static uint32_t db_to_wide_gain(int16_t gain_db)
+    {
+        uint8_t shift = 0;
+        while(gain_db > doubling_db)
+        {
+            gain_db -= doubling_db;
+            ++shift;
+        }
+        return (uint32_t)mixer::db_to_gain(gain_db) << shift;
+    }
+
+    // 1 - exp(-t/tau) in Q.15, approximated as x/(1 + x).
+    static uint16_t get_smoothing_coefficient(uint32_t block_frames, uint32_t sampling_frequency, uint16_t time_ms)
+    {
+        const uint64_t num = (uint64_t)block_frames*1000;
+        const uint64_t den = (uint64_t)sampling_frequency*time_ms;
+        return (uint16_t)((num << 15)/(num + den));
+    }
+
+    template<uint8_t Bits> static inline uint32_t saturate_sample(int64_t value)
+    {
+        constexpr int64_t max_value = ((int64_t)1 << (Bits - 1)) - 1;
+        constexpr int64_t min_value = -((int64_t)1 << (Bits - 1));
+        return (uint32_t)std::clamp(value, min_value, max_value);
+    }
+
+    template<uint8_t Bits>
+    void dynamics::process(uint8_t* begin, uint8_t* end)
+    {
+        const auto stride = m_config.stride;
+        const uint32_t frames = (end - begin)/(stride*m_config.channels);
+        if(frames == 0)
+            return;
+
+        if(frames != m_coefficient_frames)
+            update_coefficients(frames);
+
+        end = begin + frames*stride*m_config.channels;
+
+        // the channels are linked so that the stereo image doesn't move.
+        uint32_t peak = 0;
+        for(auto p = begin; p < end; p += stride)
+        {
+            const int32_t value = (int32_t)bytes_to_dword<Bits, true>(p);
+            peak = std::max(peak, (uint32_t)(value < 0 ? -value : value));
+        }
+        if constexpr (Bits > 16)
+            peak >>= (Bits - 16);
+
+        const int32_t level_db = mixer::gain_to_db((uint16_t)std::min<uint32_t>(peak, 0xffff));
+        if(level_db >= m_parameters.gate_db)
+        {
+            const int32_t coefficient = level_db > m_envelope_db ? m_attack_coefficient : m_release_coefficient;
+            m_envelope_db += ((level_db - m_envelope_db)*coefficient) >> 15;
+        }
+
+        m_gain_db = get_curve_gain_db(m_envelope_db);
+        const uint32_t next_gain = db_to_wide_gain(m_gain_db);
+
+        // ramp from the gain of the previous block. the ramp keeps 8 more bits than the gain.
+        int32_t gain_q8 = (int32_t)(m_gain << 8);
+        const int32_t gain_step = ((int32_t)(next_gain << 8) - gain_q8)/(int32_t)frames;
+
+        auto p = begin;
+        while(p < end)
+        {
+            const int64_t gain = gain_q8 >> 8;
+            for(uint8_t ch = 0; ch < m_config.channels; ++ch)
+            {
+                const int64_t value = (int32_t)bytes_to_dword<Bits, true>(p);
+                copy_dword<Bits>(p, saturate_sample<Bits>((value*gain) >> 15));
+                p += stride;
+            }
+            gain_q8 += gain_step;
+        }
+
+        m_gain = next_gain;
+    }
+
+    void dynamics::setup(const config& cfg)
+    {
+        m_config = cfg;
+
+        switch(cfg.bits)
+        {
+            case 16: m_fn_process = &dynamics::process<16>; break;
+            case 20: m_fn_process = &dynamics::process<20>; break;
+            case 24: m_fn_process = &dynamics::process<24>; break;
+            case 32: m_fn_process = &dynamics::process<32>; break;
+            default:
+                dbg_assert(false && "unsupproted bits");
+        }
+
+        set_parameters(m_parameters);
+        reset();
+    }
+
+    void dynamics::set_parameters(const parameters& params)
+    {
+        m_parameters = params;
+        m_parameters.ratio = std::max<uint8_t>(params.ratio, 1);
+        m_parameters.makeup_db = std::min(params.makeup_db, max_gain_db);
+        m_coefficient_frames = 0;
+
+        for(size_t i = 0; i < curve_steps + 1; ++i)
+        {
+            const int32_t level_db = min_level_db + (int32_t)i*256;
+            const int32_t over_db = std::max<int32_t>(level_db - m_parameters.threshold_db, 0);
+            const int32_t gain_db = m_parameters.makeup_db - (over_db - over_db/m_parameters.ratio);
+            m_curve[i] = (int16_t)std::clamp<int32_t>(gain_db, mixer::min_volume_db, max_gain_db);
+        }
+    }
+
+    void dynamics::reset()
+    {
+        m_envelope_db = min_level_db;
+        m_gain_db = get_curve_gain_db(m_envelope_db);
+        m_gain = db_to_wide_gain(m_gain_db);
+        m_coefficient_frames = 0;
+    }
+
+    void dynamics::update_coefficients(uint32_t block_frames)
+    {
+        m_attack_coefficient = get_smoothing_coefficient(block_frames, m_config.sampling_frequency, m_parameters.attack_ms);
+        m_release_coefficient = get_smoothing_coefficient(block_frames, m_config.sampling_frequency, m_parameters.release_ms);
+        m_coefficient_frames = block_frames;
+    }
+
+    int16_t dynamics::get_curve_gain_db(int32_t level_db) const
+    {
+        const int32_t pos = level_db - min_level_db;
+        if(pos <= 0)
+            return m_curve[0];
+
+        const uint32_t index = pos >> 8;
+        if(index >= curve_steps)
+            return m_curve[curve_steps];
+
+        const int32_t g0 = m_curve[index];
+        const int32_t g1 = m_curve[index + 1];
+        return (int16_t)(g0 + (((g1 - g0)*(pos & 0xff)) >> 8));
+    }
+
+    void dynamics::apply(uint8_t* begin, uint8_t* end)
+    {
+        if(!m_fn_process)
+            return;
+
+        (this->*m_fn_process)(begin, end);
+    }
+
+}
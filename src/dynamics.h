@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace processing
+{
+
+// compressor with makeup gain for a capture path. the gain is computed once per block from a peak envelope
+// and ramped across the block, so only one multiply per sample is spent in the sample loop.
+class dynamics
+{
+public:
+    // levels and gains are 1/256 dB step same as the mixer.
+    static constexpr int16_t max_gain_db = 24*256;
+    static constexpr int16_t min_level_db = -96*256;
+
+    struct config
+    {
+        uint8_t bits;
+        uint8_t stride;
+        uint8_t channels;
+        uint32_t sampling_frequency;
+    };
+
+    struct parameters
+    {
+        int16_t threshold_db;
+        int16_t makeup_db;
+        // the envelope holds below the gate, so that the makeup gain doesn't follow the noise floor.
+        int16_t gate_db;
+        uint16_t attack_ms;
+        uint16_t release_ms;
+        // n:1 above the threshold. 1 leaves only the makeup gain.
+        uint8_t ratio;
+    };
+
+    void setup(const config&);
+    void set_parameters(const parameters&);
+    const parameters& get_parameters() const { return m_parameters; }
+    void reset();
+    void apply(uint8_t* begin, uint8_t* end);
+
+    int16_t get_gain_db() const { return m_gain_db; }
+
+private:
+    using fn_process_t = void(dynamics::*)(uint8_t* begin, uint8_t* end);
+
+    static constexpr size_t curve_steps = -min_level_db/256;
+
+    config m_config;
+    parameters m_parameters = {
+        .threshold_db = -20*256,
+        .makeup_db = 6*256,
+        .gate_db = -60*256,
+        .attack_ms = 5,
+        .release_ms = 300,
+        .ratio = 4};
+    // static gain for each 1dB of the envelope from min_level_db to 0dB.
+    int16_t m_curve[curve_steps + 1];
+    int32_t m_envelope_db;
+    int16_t m_gain_db;
+    // unsigned Q.15 up to max_gain_db.
+    uint32_t m_gain;
+    uint32_t m_coefficient_frames;
+    uint16_t m_attack_coefficient;
+    uint16_t m_release_coefficient;
+    fn_process_t m_fn_process = nullptr;
+
+    void update_coefficients(uint32_t block_frames);
+    int16_t get_curve_gain_db(int32_t level_db) const;
+    template<uint8_t Bits>
+        void process(uint8_t* begin, uint8_t* end);
+};
+
+}
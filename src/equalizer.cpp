@@ -0,0 +1,136 @@
+#include <pico/platform.h>
+#include <cstring>
+#include <algorithm>
+#include "support.h"
+#include "debug.h"
+#include "equalizer.h"
+
+namespace processing
+{
+    using namespace support;
+
+    constexpr uint8_t internal_bits = 24;
+    constexpr uint8_t coefficient_shift = 30;
+    constexpr size_t chunk_frames = 32;
+
+    template<uint8_t Bits> static inline int32_t to_internal(uint32_t value)
+    {
+        if constexpr (Bits <= internal_bits)
+            return (int32_t)value << (internal_bits - Bits);
+        else
+            return (int32_t)value >> (Bits - internal_bits);
+    }
+
+    template<uint8_t Bits> static inline uint32_t from_internal(int32_t value)
+    {
+        constexpr int32_t max_value = (1 << (internal_bits - 1)) - 1;
+        constexpr int32_t min_value = -(1 << (internal_bits - 1));
+        value = std::clamp(value, min_value, max_value);
+
+        if constexpr (Bits <= internal_bits)
+            return (uint32_t)(value >> (internal_bits - Bits));
+        else
+            return (uint32_t)value << (Bits - internal_bits);
+    }
+
+    // direct form 1. the truncated fraction of the output is fed back to the next sample.
+    static void process_section(const equalizer::section& c, int32_t& x1, int32_t& x2, int32_t& y1, int32_t& y2, uint32_t& error, int32_t* samples, int32_t* samples_end, uint8_t step)
+    {
+        constexpr uint32_t fraction_mask = (1u << coefficient_shift) - 1;
+
+        for(auto p = samples; p < samples_end; p += step)
+        {
+            const int32_t x = *p;
+            const int64_t acc = (int64_t)error
+                + (int64_t)c.b0*x + (int64_t)c.b1*x1 + (int64_t)c.b2*x2
+                - (int64_t)c.a1*y1 - (int64_t)c.a2*y2;
+            const int32_t y = (int32_t)(acc >> coefficient_shift);
+            error = (uint32_t)acc & fraction_mask;
+
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            *p = y;
+        }
+    }
+
+    template<uint8_t Bits>
+    void equalizer::process(uint8_t* begin, uint8_t* end)
+    {
+        const auto stride = m_config.stride;
+        const uint8_t channels = m_config.channels;
+        const size_t frame_bytes = stride*channels;
+
+        int32_t work[chunk_frames*max_channels];
+
+        auto p = begin;
+        while(p + frame_bytes <= end)
+        {
+            const size_t frames = std::min<size_t>(chunk_frames, (end - p)/frame_bytes);
+            const size_t samples = frames*channels;
+
+            for(size_t i = 0; i < samples; ++i)
+                work[i] = to_internal<Bits>(bytes_to_dword<Bits, true>(p + i*stride));
+
+            // a section runs through the chunk at once so that its coefficients and state stay close.
+            for(uint8_t s = 0; s < m_section_count; ++s)
+            {
+                for(uint8_t ch = 0; ch < channels; ++ch)
+                {
+                    auto& st = m_states[s][ch];
+                    process_section(m_sections[s], st.x1, st.x2, st.y1, st.y2, st.error, work + ch, work + samples, channels);
+                }
+            }
+
+            for(size_t i = 0; i < samples; ++i)
+                copy_dword<Bits>(p + i*stride, from_internal<Bits>(work[i]));
+
+            p += frames*frame_bytes;
+        }
+    }
+
+    void equalizer::setup(const config& cfg)
+    {
+        dbg_assert(cfg.channels <= max_channels);
+
+        m_config = cfg;
+
+        switch(cfg.bits)
+        {
+            case 16: m_fn_process = &equalizer::process<16>; break;
+            case 20: m_fn_process = &equalizer::process<20>; break;
+            case 24: m_fn_process = &equalizer::process<24>; break;
+            case 32: m_fn_process = &equalizer::process<32>; break;
+            default:
+                dbg_assert(false && "unsupproted bits");
+        }
+
+        reset();
+    }
+
+    void equalizer::set_sections(const section* sections, uint8_t count)
+    {
+        count = std::min(count, max_sections);
+
+        for(uint8_t s = m_section_count; s < count; ++s)
+            std::memset(m_states[s], 0, sizeof(m_states[s]));
+
+        std::copy(sections, sections + count, m_sections);
+        m_section_count = count;
+    }
+
+    void equalizer::reset()
+    {
+        std::memset(m_states, 0, sizeof(m_states));
+    }
+
+    void equalizer::apply(uint8_t* begin, uint8_t* end)
+    {
+        if(m_section_count == 0 || !m_fn_process)
+            return;
+
+        (this->*m_fn_process)(begin, end);
+    }
+
+}
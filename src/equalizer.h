@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace processing
+{
+
+// cascaded biquads in Q2.30 with 64bit accumulation. samples run at 24bit inside, leaving 8bit of headroom between sections.
+// most of the cost is the five 32x32->64 multiplies per section and sample. a section costs the same at any resolution,
+// only the unpacking and packing around the chunk follow the bits. the output path measures a section at 16 and 24bit
+// at init, as the time of all sections less one section, and limits the count to its budget. the stats print the
+// cycles per sample and the share of a core at 48 and 96kHz.
+// PROF_MIXOUT_EQ profiles the whole stage.
+class equalizer
+{
+public:
+    static constexpr uint8_t max_sections = 8;
+    static constexpr uint8_t max_channels = 2;
+
+    // y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2, normalized with a0.
+    struct section
+    {
+        int32_t b0;
+        int32_t b1;
+        int32_t b2;
+        int32_t a1;
+        int32_t a2;
+    };
+
+    struct config
+    {
+        uint8_t bits;
+        uint8_t stride;
+        uint8_t channels;
+    };
+
+    void setup(const config&);
+    // sections added by a change of count start from a cleared state.
+    void set_sections(const section* sections, uint8_t count);
+    uint8_t get_section_count() const { return m_section_count; }
+    void reset();
+    void apply(uint8_t* begin, uint8_t* end);
+
+private:
+    using fn_process_t = void(equalizer::*)(uint8_t* begin, uint8_t* end);
+
+    struct state
+    {
+        int32_t x1;
+        int32_t x2;
+        int32_t y1;
+        int32_t y2;
+        uint32_t error;
+    };
+
+    config m_config;
+    section m_sections[max_sections];
+    state m_states[max_sections][max_channels];
+    uint8_t m_section_count = 0;
+    fn_process_t m_fn_process = nullptr;
+
+    template<uint8_t Bits>
+        void process(uint8_t* begin, uint8_t* end);
+};
+
+}
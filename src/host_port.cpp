@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "debug.h"
+#include "host_port.h"
+
+#if !PICO_ON_DEVICE
+
+namespace
+{
+    thread_local uint8_t g_core_num = 0;
+
+    std::atomic<bool> g_virtual_clock{false};
+    std::atomic<uint64_t> g_virtual_time_us{0};
+
+    std::mutex g_event_mutex;
+    std::condition_variable g_event_cond;
+    uint32_t g_event_generation = 0;
+
+    // from the first call, like the time since boot on the device.
+    uint64_t get_real_time_us()
+    {
+        static const auto origin = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+}
+
+void critical_section_init(critical_section_t *crit_sec)
+{
+    crit_sec->lock.clear(std::memory_order_release);
+}
+
+void critical_section_deinit(critical_section_t *)
+{
+}
+
+void critical_section_enter_blocking(critical_section_t *crit_sec)
+{
+    while(crit_sec->lock.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+}
+
+void critical_section_exit(critical_section_t *crit_sec)
+{
+    crit_sec->lock.clear(std::memory_order_release);
+}
+
+uint64_t time_us_64()
+{
+    return g_virtual_clock.load(std::memory_order_acquire) ? g_virtual_time_us.load(std::memory_order_acquire) : get_real_time_us();
+}
+
+uint32_t time_us_32()
+{
+    return uint32_t(time_us_64());
+}
+
+unsigned int get_core_num()
+{
+    return g_core_num;
+}
+
+extern "C" void dbg_print_init()
+{
+}
+
+extern "C" int dbg_printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    const int result = vprintf(format, args);
+    va_end(args);
+    return result;
+}
+
+namespace host
+{
+    void use_virtual_clock(bool enable)
+    {
+        g_virtual_time_us.store(0, std::memory_order_release);
+        g_virtual_clock.store(enable, std::memory_order_release);
+        signal_event();
+    }
+
+    void set_time_us(uint64_t time)
+    {
+        g_virtual_time_us.store(time, std::memory_order_release);
+        signal_event();
+    }
+
+    void advance_time_us(uint64_t delta)
+    {
+        g_virtual_time_us.fetch_add(delta, std::memory_order_acq_rel);
+        signal_event();
+    }
+
+    void set_core_num(uint8_t core)
+    {
+        g_core_num = core;
+    }
+
+    std::thread launch_core(uint8_t core, std::function<void()> entry)
+    {
+        return std::thread([core, entry] {
+            set_core_num(core);
+            entry();
+        });
+    }
+
+    void signal_event()
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_event_mutex);
+            ++g_event_generation;
+        }
+        g_event_cond.notify_all();
+    }
+
+    uint32_t get_event_generation()
+    {
+        std::lock_guard<std::mutex> lock(g_event_mutex);
+        return g_event_generation;
+    }
+
+    // on the virtual clock the time passes only by an event, so only the generation is waited for.
+    void wait_event(uint64_t until, uint32_t generation)
+    {
+        std::unique_lock<std::mutex> lock(g_event_mutex);
+        auto pred = [generation] { return g_event_generation != generation; };
+        if(until == UINT64_MAX || g_virtual_clock.load(std::memory_order_acquire))
+        {
+            if(until > time_us_64())
+                g_event_cond.wait(lock, pred);
+        }
+        else
+        {
+            const auto now = time_us_64();
+            if(until > now)
+                g_event_cond.wait_for(lock, std::chrono::microseconds(until - now), pred);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+// stand-ins for the sdk functions job_queue and the ring buffers use, so the scheduler builds and runs on a linux host:
+//   g++ -std=c++17 -pthread -Isrc src/job_queue.cpp src/host_port.cpp <driver>.cpp
+// std::threads play the cores, a critical section is a spinlock, and the clock is either the real one or a virtual one
+// that only the driver moves.
+
+#if !PICO_ON_DEVICE
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+struct critical_section
+{
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+typedef struct critical_section critical_section_t;
+
+void critical_section_init(critical_section_t *crit_sec);
+void critical_section_deinit(critical_section_t *crit_sec);
+void critical_section_enter_blocking(critical_section_t *crit_sec);
+void critical_section_exit(critical_section_t *crit_sec);
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+unsigned int get_core_num();
+
+namespace host
+{
+    // the virtual clock starts at 0 and moves only by set_time_us() and advance_time_us(), which wake sleeping cores
+    // so they see the jobs that became due.
+    void use_virtual_clock(bool enable);
+    void set_time_us(uint64_t time);
+    void advance_time_us(uint64_t delta);
+
+    // a thread is core0 until set otherwise. launch_core() starts a thread as the given core.
+    void set_core_num(uint8_t core);
+    std::thread launch_core(uint8_t core, std::function<void()> entry);
+
+    // the sev/wfe event latch. a waiter takes the generation before it checks its condition, and wait_event() returns
+    // at once when an event was signalled since, so none is lost in between.
+    void signal_event();
+    uint32_t get_event_generation();
+    void wait_event(uint64_t until, uint32_t generation);
+}
+
+#endif
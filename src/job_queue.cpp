@@ -1,141 +1,733 @@
+#if PICO_ON_DEVICE
 #include <pico/sync.h>
+#include <hardware/timer.h>
+#else
+#include "host_port.h"
+#endif
+#include <algorithm>
+#include <array>
 #include "debug.h"
+#include "circular_buffer.h"
 #include "job_queue.h"
 
 namespace job_queue
 {
     using node = data_structure::node;
 
-    inline namespace internal
+    using data_structure::published;
+
+    // pending jobs only. a due job waits in the ready list of its priority, sorted by deadline, and a delayed one
+    // in a min-heap by due time, which execute() promotes from when the top is due. so dispatch looks at the
+    // heads of the lists instead of every active job, and the heap top is the next time anything becomes due.
+    // there is one queue per core for the jobs bound to it and one shared by both, each under its own lock.
+    // the ready count and the next due time are published, so a core skips the lock of a queue with nothing due.
+    class system::run_queue
     {
-        node    g_node_root = { &g_node_root, &g_node_root };
-        critical_section g_critical_section;
+    public:
+        static constexpr uint8_t max_delayed_jobs = 16;
+        static_assert(max_delayed_jobs < work::not_delayed, "a heap index must not reach not_delayed");
+
+        run_queue()
+        {
+            for(auto &root : m_ready)
+                root = node(&root, &root);
+        }
+
+        void init() { critical_section_init(&m_critical_section); }
+        void destroy() { critical_section_deinit(&m_critical_section); }
+        void lock() { critical_section_enter_blocking(&m_critical_section); }
+        void unlock() { critical_section_exit(&m_critical_section); }
+
+        // without the lock. a stale answer costs a needless lock, or the job waits for the next round.
+        bool may_have_work(uint64_t time) const
+        {
+            return m_hint_ready.load_acquire()
+                || (m_hint_delayed.load_acquire() && int32_t(uint32_t(time) - m_hint_next_at.load_relaxed()) > 0);
+        }
+
+        // with the heap full a delayed job is queued as due instead. it runs early and, like every polling job,
+        // checks its condition and delays itself again, so a full heap costs rounds but never the queue.
+        void push(work* job)
+        {
+            if(job->m_at && m_delayed_count < max_delayed_jobs)
+            {
+                push_delayed(job);
+            }
+            else
+            {
+                if(job->m_at)
+                {
+                    ++m_delayed_overflows;
+                    JOB_TRACE_LOG("delayed heap full, queued as due\n");
+                }
+                push_ready(job);
+            }
+            update_hints();
+        }
+
+        void remove(work* job)
+        {
+            if(job->m_heap_index != work::not_delayed)
+            {
+                remove_delayed(job);
+            }
+            else
+            {
+                static_cast<node*>(job)->remove();
+                --m_ready_count;
+            }
+            update_hints();
+        }
+
+        void promote(uint64_t time)
+        {
+            while(m_delayed_count && m_delayed[0]->m_at < time)
+            {
+                auto job = m_delayed[0];
+                remove_delayed(job);
+                push_ready(job);
+            }
+            update_hints();
+        }
+
+        // every job here may run on the core looking, so the head of the highest ready list is the one.
+        work* peek() const
+        {
+            for(auto root = m_ready.rbegin(); root != m_ready.rend(); ++root)
+            {
+                if(root->next() != &*root)
+                    return static_cast<work*>(root->next());
+            }
+            return nullptr;
+        }
+
+        void pop(work* job)
+        {
+            static_cast<node*>(job)->remove();
+            --m_ready_count;
+            update_hints();
+        }
+
+        void record_deadline_miss() { ++m_deadline_misses; }
+        uint32_t get_deadline_misses() const { return m_deadline_misses; }
+        uint32_t get_delayed_overflows() const { return m_delayed_overflows; }
 
-        inline void lock()
+        // 0 while a job is ready, UINT64_MAX while nothing is pending.
+        uint64_t get_next_wake_time() const
         {
-            critical_section_enter_blocking(&g_critical_section);
+            for(const auto &root : m_ready)
+            {
+                if(root.next() != &root)
+                    return 0;
+            }
+            return m_delayed_count ? m_delayed[0]->m_at : UINT64_MAX;
         }
 
-        inline void unlock()
+    private:
+        critical_section m_critical_section;
+        std::array<node, priority_num> m_ready;
+        std::array<work*, max_delayed_jobs> m_delayed;
+        uint8_t m_ready_count = 0;
+        uint8_t m_delayed_count = 0;
+        uint32_t m_deadline_misses = 0;
+        uint32_t m_delayed_overflows = 0;
+        published<uint32_t> m_hint_ready;
+        published<bool> m_hint_delayed;
+        published<uint32_t> m_hint_next_at;
+
+        void update_hints()
         {
-            critical_section_exit(&g_critical_section);
+            if(m_delayed_count)
+                m_hint_next_at.store_release(uint32_t(m_delayed[0]->m_at));
+            m_hint_delayed.store_release(m_delayed_count > 0);
+            m_hint_ready.store_release(m_ready_count);
         }
 
+        // after the last job due no later, so the jobs without a deadline stay in the order they were queued.
+        void push_ready(work* job)
+        {
+            auto &root = m_ready[job->m_priority];
+            const auto deadline = job->get_deadline();
+            node* where = root.prev();
+            while(where != &root && static_cast<work*>(where)->get_deadline() > deadline)
+                where = where->prev();
+            static_cast<node*>(job)->insert(where);
+            ++m_ready_count;
+        }
+
+        void push_delayed(work* job)
+        {
+            place(job, m_delayed_count++);
+            sift_up(job->m_heap_index);
+        }
+
+        void remove_delayed(work* job)
+        {
+            const auto index = job->m_heap_index;
+            job->m_heap_index = work::not_delayed;
+            if(index == --m_delayed_count)
+                return;
+
+            place(m_delayed[m_delayed_count], index);
+            sift_up(index);
+            sift_down(m_delayed[index]->m_heap_index);
+        }
+
+        void place(work* job, uint8_t index)
+        {
+            m_delayed[index] = job;
+            job->m_heap_index = index;
+        }
+
+        void sift_up(uint8_t index)
+        {
+            auto job = m_delayed[index];
+            while(index > 0)
+            {
+                const uint8_t parent = (index - 1) / 2;
+                if(m_delayed[parent]->m_at <= job->m_at)
+                    break;
+                place(m_delayed[parent], index);
+                index = parent;
+            }
+            place(job, index);
+        }
+
+        void sift_down(uint8_t index)
+        {
+            auto job = m_delayed[index];
+            for(;;)
+            {
+                uint8_t child = index * 2 + 1;
+                if(child >= m_delayed_count)
+                    break;
+                if(child + 1 < m_delayed_count && m_delayed[child + 1]->m_at < m_delayed[child]->m_at)
+                    ++child;
+                if(job->m_at <= m_delayed[child]->m_at)
+                    break;
+                place(m_delayed[child], index);
+                index = child;
+            }
+            place(job, index);
+        }
+    };
+
+    inline namespace internal
+    {
+        constexpr uint8_t num_cores = system::num_cores;
+        constexpr uint8_t shared_queue = num_cores;
+
+        std::array<system::run_queue, num_cores + 1> g_run_queues;
+        std::array<uint64_t, num_cores> g_idle_us = {};
+        // the job each core waits in wait_done() for, so the end of a run raises an event only when someone waits.
+        std::array<published<work*>, num_cores> g_waiting_for = {};
+#if JOB_STATS_ENABLE
+        work* g_stats_jobs = nullptr;
+        work* g_stats_jobs_tail = nullptr;
+
+        inline uint8_t get_histogram_bin(uint32_t us)
+        {
+            uint8_t bin = 0;
+            while(bin < job_stats::histogram_bins - 1 && us >= (4u << (2*bin)))
+                ++bin;
+            return bin;
+        }
+#endif
+
         inline uint8_t get_core_bit()
         {
             return 1 << get_core_num();
         }
+
+#if PICO_ON_DEVICE
+        // each core arms its own alarm, the irq is taken on the core that set the callback and ends its wfe.
+        std::array<int, num_cores> g_alarms = { -1, -1 };
+
+        void on_alarm(uint) {}
+
+        // sev sets the event latch of both cores, so an event raised between the queue check and the wfe is not lost.
+        inline void signal_event()
+        {
+            __sev();
+        }
+
+        inline void wait_event(uint64_t until)
+        {
+            const auto core = get_core_num();
+            if(until != UINT64_MAX)
+            {
+                if(g_alarms[core] < 0)
+                {
+                    g_alarms[core] = hardware_alarm_claim_unused(true);
+                    hardware_alarm_set_callback(g_alarms[core], on_alarm);
+                }
+                // true when the time has already passed.
+                if(hardware_alarm_set_target(g_alarms[core], from_us_since_boot(until)))
+                    return;
+            }
+            __wfe();
+        }
+#else
+        using host::signal_event;
+        using host::get_event_generation;
+        using host::wait_event;
+
+        published<bool> g_stopped;
+#endif
     }
 
-    
+
     void system::init()
     {
-        critical_section_init(&g_critical_section);
+        for(auto &queue : g_run_queues)
+            queue.init();
+#if !PICO_ON_DEVICE
+        g_stopped.store_release(false);
+#endif
     }
 
     void system::destroy()
     {
-        critical_section_deinit(&g_critical_section);
+        for(auto &queue : g_run_queues)
+            queue.destroy();
     }
-    
-    void system::execute()
+
+    void system::run()
+    {
+#if PICO_ON_DEVICE
+        while(true)
+#else
+        while(!g_stopped.load_acquire())
+#endif
+        {
+            if(!execute())
+                idle();
+        }
+    }
+
+    bool system::execute()
     {
-        auto core_affinity = 1<<get_core_num();
-        auto time = time_us_64();
+        const auto core = get_core_num();
+        const auto time = time_us_64();
+
+        auto &own = g_run_queues[core];
+        auto &shared = g_run_queues[shared_queue];
+        const bool check_own = own.may_have_work(time);
+        const bool check_shared = shared.may_have_work(time);
+        if(!check_own && !check_shared)
+            return false;
 
         work *exec_job = nullptr;
 
-        lock();
+        // a core takes its own queue before the shared one and never the other core's, so the locks cannot deadlock.
+        if(check_own)
+            own.lock();
+        if(check_shared)
+            shared.lock();
         {
-            node* node = g_node_root.next();
-            while(node && node != &g_node_root)
+            work *own_job = nullptr;
+            work *shared_job = nullptr;
+            if(check_own)
+            {
+                own.promote(time);
+                own_job = own.peek();
+            }
+            if(check_shared)
+            {
+                shared.promote(time);
+                shared_job = shared.peek();
+            }
+
+            auto *queue = &own;
+            exec_job = own_job;
+            if(shared_job && (!own_job || shared_job->is_prior(own_job)))
             {
-                auto job = static_cast<work*>(node);
-                if(job->m_pending 
-                    && (job->m_running == 0)
-                    && (job->m_affinity_mask&core_affinity) 
-                    && (job->m_at == 0 || job->m_at < time))
+                queue = &shared;
+                exec_job = shared_job;
+            }
+
+            if(exec_job)
+            {
+                queue->pop(exec_job);
+                if(exec_job->get_deadline() < time)
                 {
-                    job->m_running = core_affinity;
-                    job->m_pending = false;
-                    job->remove();
-                    exec_job = job;
-                    break;
+                    ++exec_job->m_deadline_misses;
+                    queue->record_deadline_miss();
+                    JOB_TRACE_LOG("deadline missed by %u us\n", uint32_t(time - exec_job->m_deadline_at));
                 }
-                node = node->next();
+
+                exec_job->m_running.store_release(1 << core);
+                exec_job->m_pending = false;
             }
         }
-        unlock();
+        if(check_shared)
+            shared.unlock();
+        if(check_own)
+            own.unlock();
 
         if(exec_job)
         {
+#if JOB_STATS_ENABLE
+            const auto start = time_us_64();
+            (*exec_job)();
+            exec_job->record_stats(start, time_us_64(), core);
+#else
             (*exec_job)();
+#endif
 
-            lock();
+            bool requeued;
+            bool completed;
+            bool waited = false;
+            auto &home = g_run_queues[exec_job->m_queue];
+            home.lock();
             {
-                if(!exec_job->m_removed)
-                    exec_job->insert(g_node_root.prev());
-                exec_job->m_running = 0;
+                // pending again from inside the run, or from elsewhere while it ran.
+                requeued = exec_job->m_active && exec_job->m_pending;
+                completed = exec_job->m_active && !exec_job->m_pending;
+                if(requeued)
+                    home.push(exec_job);
+                exec_job->m_running.store_release(0);
             }
-            unlock();
+            home.unlock();
+
+            // pairs with the barrier in wait_done(), either the waiter sees the run ended or this sees the waiter.
+            data_structure::memory_barrier();
+            for(const auto &waiting : g_waiting_for)
+                waited |= waiting.load_relaxed() == exec_job;
+
+            if(requeued || waited)
+                signal_event();
+
+            if(completed)
+            {
+                for(uint8_t i = 0; i < exec_job->m_continuation_count; ++i)
+                    exec_job->m_continuations[i]->notify_dependency();
+            }
+        }
+
+        return exec_job != nullptr;
+    }
+
+#if !PICO_ON_DEVICE
+    void system::stop()
+    {
+        g_stopped.store_release(true);
+        signal_event();
+    }
+#endif
+
+    // sleeps until a job is queued or the next delayed job of this core is due. a wakeup for a job the other core
+    // takes first costs one more round here.
+    void system::idle()
+    {
+#if !PICO_ON_DEVICE
+        const auto generation = get_event_generation();
+#endif
+        const auto until = get_next_wake_time();
+        const auto begin = time_us_64();
+        if(until <= begin)
+            return;
+
+#if PICO_ON_DEVICE
+        wait_event(until);
+#else
+        wait_event(until, generation);
+#endif
+        g_idle_us[get_core_num()] += time_us_64() - begin;
+    }
+
+    uint64_t system::get_idle_us(uint8_t core)
+    {
+        return g_idle_us[core];
+    }
+
+    uint32_t system::get_deadline_misses()
+    {
+        uint32_t misses = 0;
+        for(const auto &queue : g_run_queues)
+            misses += queue.get_deadline_misses();
+        return misses;
+    }
+
+    uint32_t system::get_delayed_overflows()
+    {
+        uint32_t overflows = 0;
+        for(const auto &queue : g_run_queues)
+            overflows += queue.get_delayed_overflows();
+        return overflows;
+    }
+
+    uint64_t system::get_next_wake_time()
+    {
+        uint64_t time = UINT64_MAX;
+        for(auto *queue : { &g_run_queues[get_core_num()], &g_run_queues[shared_queue] })
+        {
+            queue->lock();
+            time = std::min(time, queue->get_next_wake_time());
+            queue->unlock();
         }
+        return time;
+    }
+
+    bool work::is_queued() const
+    {
+        return m_active && m_pending && !m_running.load_relaxed();
     }
 
     void work::activate()
     {
-        m_at = 0;
-        m_running = 0;
-        m_pending = false;
-        m_removed = false;
-        
-        lock();
-        insert(g_node_root.prev());
-        unlock();
+#if JOB_STATS_ENABLE
+        {
+            // the registry hangs off the shared queue's lock, taken before the job's own.
+            auto &registry = g_run_queues[shared_queue];
+            registry.lock();
+            if(!m_stats_registered)
+            {
+                m_stats_registered = true;
+                (g_stats_jobs_tail ? g_stats_jobs_tail->m_next_stats_job : g_stats_jobs) = this;
+                g_stats_jobs_tail = this;
+            }
+            registry.unlock();
+        }
+#endif
+        auto &queue = g_run_queues[m_queue];
+        queue.lock();
+        {
+            if(is_queued())
+                queue.remove(this);
+            m_at = 0;
+            m_pending = false;
+            m_active = true;
+        }
+        queue.unlock();
     }
-    
+
+    // a running job finishes its run and is not queued again.
     void work::deactivate()
     {
-        lock();
+        auto &queue = g_run_queues[m_queue];
+        queue.lock();
         {
-            if(m_running)
-                m_removed = true;
-            else
-                remove();
+            if(is_queued())
+                queue.remove(this);
+            m_active = false;
         }
-        unlock();
+        queue.unlock();
     }
 
-    void work::wait_done()
+    bool work::wait_done(uint32_t timeout_us)
     {
-        while(m_running);
+        const auto core = get_core_num();
+        dbg_assert(m_running.load_relaxed() != (1 << core));
+
+        const auto until = timeout_us == UINT32_MAX ? UINT64_MAX : time_us_64() + timeout_us;
+        auto &waiting = g_waiting_for[core];
+        waiting.store_release(this);
+        data_structure::memory_barrier();
+
+        bool done;
+        while(true)
+        {
+#if !PICO_ON_DEVICE
+            const auto generation = get_event_generation();
+#endif
+            done = m_running.load_acquire() == 0;
+            if(done || time_us_64() >= until)
+                break;
+#if PICO_ON_DEVICE
+            wait_event(until);
+#else
+            wait_event(until, generation);
+#endif
+        }
+
+        waiting.store_release(nullptr);
+        return done;
     }
 
+    // a job bound to one core is queued on that core's queue, one allowed on both on the shared queue.
+    // the queue follows the mask, so it must not change while the job is queued.
     void work::set_affinity_mask(uint8_t affinity_mask)
     {
+        dbg_assert(affinity_mask != 0 && affinity_mask < (1 << num_cores) && !is_queued());
         m_affinity_mask = affinity_mask;
+        m_queue = shared_queue;
+        for(uint8_t core = 0; core < num_cores; ++core)
+        {
+            if(affinity_mask == (1 << core))
+                m_queue = core;
+        }
+    }
+
+    bool work::is_prior(const work* than) const
+    {
+        if(m_priority != than->m_priority)
+            return m_priority > than->m_priority;
+        return get_deadline() < than->get_deadline();
+    }
+
+    uint64_t work::get_deadline() const
+    {
+        return m_deadline_us ? m_deadline_at : UINT64_MAX;
+    }
+
+    void work::set_priority(uint8_t priority)
+    {
+        dbg_assert(priority < priority_num);
+        m_priority = priority;
+    }
+
+    void work::set_deadline_us(uint32_t deadline)
+    {
+        m_deadline_us = deadline;
     }
 
     void work::set_pending()
     {
-        m_at = 0;
-        m_pending = true;
+        const uint64_t deadline_at = m_deadline_us ? time_us_64() + m_deadline_us : 0;
+        set_pending(0, deadline_at);
     }
 
     void work::set_pending_delay_us(uint32_t delay)
     {
-        m_at = time_us_64() + delay;
-        m_pending = true;
+        const auto at = time_us_64() + delay;
+        set_pending(at, at + m_deadline_us);
     }
 
     void work::set_pending_at(uint64_t time)
     {
-        m_at = time;
-        m_pending = true;
+        set_pending(time, time + m_deadline_us);
+    }
+
+    // an inactive or running job only keeps the request, activate() drops it and the end of the run queues it.
+    void work::set_pending(uint64_t at, uint64_t deadline_at)
+    {
+        auto &queue = g_run_queues[m_queue];
+        queue.lock();
+        {
+            if(is_queued())
+                queue.remove(this);
+
+            m_at = at;
+            m_deadline_at = deadline_at;
+            m_pending = true;
+#if JOB_STATS_ENABLE
+            m_due_at = at ? at : time_us_64();
+#endif
+
+            if(m_active && !m_running.load_relaxed())
+                queue.push(this);
+        }
+        queue.unlock();
+
+        signal_event();
+    }
+
+    void work::add_continuation(work* next)
+    {
+        dbg_assert(m_continuation_count < max_continuations);
+        m_continuations[m_continuation_count++] = next;
+    }
+
+    void work::set_dependencies(uint8_t count)
+    {
+        auto &queue = g_run_queues[m_queue];
+        queue.lock();
+        m_remaining_dependencies.store_release(count);
+        queue.unlock();
+    }
+
+    void work::notify_dependency()
+    {
+        bool ready;
+        auto &queue = g_run_queues[m_queue];
+        queue.lock();
+        {
+            const auto remaining = m_remaining_dependencies.load_relaxed();
+            ready = remaining <= 1;
+            m_remaining_dependencies.store_release(ready ? 0 : remaining - 1);
+        }
+        queue.unlock();
+
+        if(ready)
+            set_pending();
     }
 
     bool work::is_idle() const
     {
-        return !m_pending && (m_running == 0);
+        return !m_pending && (m_running.load_acquire() == 0);
+    }
+
+#if JOB_STATS_ENABLE
+    // written only by the core running the job, a reader on the other core may see a run half recorded.
+    void work::record_stats(uint64_t start, uint64_t end, uint8_t core)
+    {
+        const uint32_t latency = start > m_due_at ? start - m_due_at : 0;
+        const uint32_t run = end - start;
+
+        ++m_stats.dispatches;
+        m_stats.min_latency_us = std::min(m_stats.min_latency_us, latency);
+        m_stats.max_latency_us = std::max(m_stats.max_latency_us, latency);
+        m_stats.total_latency_us += latency;
+        ++m_stats.latency_histogram[get_histogram_bin(latency)];
+        m_stats.min_run_us = std::min(m_stats.min_run_us, run);
+        m_stats.max_run_us = std::max(m_stats.max_run_us, run);
+        m_stats.total_run_us += run;
+        ++m_stats.run_histogram[get_histogram_bin(run)];
+        ++m_stats.core_dispatches[core];
+    }
+
+    void work::reset_stats()
+    {
+        m_stats = {};
+    }
+
+    work* system::get_job(uint16_t index)
+    {
+        auto job = g_stats_jobs;
+        while(job && index--)
+            job = job->m_next_stats_job;
+        return job;
+    }
+
+    void system::print_stats()
+    {
+        auto print_histogram = [](const char* label, const std::array<uint32_t, job_stats::histogram_bins> &histogram) {
+            dbg_printf("      %s:", label);
+            for(const auto count : histogram)
+                dbg_printf(" %u", count);
+            dbg_printf("\n");
+        };
+
+        dbg_printf("  job stats:\n");
+        dbg_printf("    delayed overflows: %u\n", get_delayed_overflows());
+        for(auto job = g_stats_jobs; job; job = job->m_next_stats_job)
+        {
+            const auto &stats = job->m_stats;
+            if(stats.dispatches == 0)
+                continue;
+
+            dbg_printf(
+                "    %s:\n"
+                "      dispatches: %u (core0 %u core1 %u)\n"
+                "      latency: %u/%u/%u us\n"
+                "      run: %u/%u/%u us\n"
+                "      deadline misses: %u\n",
+                job->m_name,
+                stats.dispatches, stats.core_dispatches[0], stats.core_dispatches[1],
+                stats.min_latency_us, uint32_t(stats.total_latency_us / stats.dispatches), stats.max_latency_us,
+                stats.min_run_us, uint32_t(stats.total_run_us / stats.dispatches), stats.max_run_us,
+                job->m_deadline_misses);
+            print_histogram("latency histogram", stats.latency_histogram);
+            print_histogram("run histogram", stats.run_histogram);
+        }
+    }
+
+    void system::reset_stats()
+    {
+        for(auto job = g_stats_jobs; job; job = job->m_next_stats_job)
+            job->reset_stats();
     }
+#endif
 
 }
@@ -1,20 +1,85 @@
 #pragma once
 
 #include <stdint.h>
+#include <array>
 #include "node.h"
+#include "circular_buffer.h"
 
 #if !defined(JOB_TRACE_ENABLE)
 #define JOB_TRACE_ENABLE    0
 #endif
 
+#if !defined(JOB_STATS_ENABLE)
+#define JOB_STATS_ENABLE    0
+#endif
+
 namespace job_queue
 {
+    // a ready job of a higher priority always runs first. among the same priority the earliest deadline runs first,
+    // and jobs without a deadline follow in the order they were queued.
+    enum priority : uint8_t
+    {
+        priority_background = 0,
+        priority_normal,
+        priority_audio,
+        priority_num
+    };
+
+    class work;
+
+    // per job since the last reset. latency is from due to start, so a delayed job counts from its due time.
+    struct job_stats
+    {
+        static constexpr uint8_t histogram_bins = 8;
+        static constexpr uint8_t max_cores = 2;
+
+        uint32_t dispatches = 0;
+        uint32_t min_latency_us = UINT32_MAX;
+        uint32_t max_latency_us = 0;
+        uint32_t min_run_us = UINT32_MAX;
+        uint32_t max_run_us = 0;
+        uint64_t total_latency_us = 0;
+        uint64_t total_run_us = 0;
+        // bin n counts times under 4^(n+1) us, the last one the rest.
+        std::array<uint32_t, histogram_bins> latency_histogram = {};
+        std::array<uint32_t, histogram_bins> run_histogram = {};
+        std::array<uint32_t, max_cores> core_dispatches = {};
+    };
+
     class system
     {
     public:
+        static constexpr uint8_t num_cores = job_stats::max_cores;
+
         static void init();
         static void destroy();
-        static void execute();
+        // dispatches jobs on the calling core forever, sleeping while none is due.
+        static void run();
+#if !PICO_ON_DEVICE
+        // makes run() return on every core. the host port only, the device cores never stop.
+        static void stop();
+#endif
+        // runs one due job if any, returns whether it did.
+        static bool execute();
+        static void idle();
+
+        // time the core spent asleep in idle().
+        static uint64_t get_idle_us(uint8_t core);
+
+#if JOB_STATS_ENABLE
+        // the jobs activated so far in the order of their first activation, nullptr past the last.
+        static work* get_job(uint16_t index);
+        static void print_stats();
+        static void reset_stats();
+#endif
+
+        static uint32_t get_deadline_misses();
+        // delayed jobs queued as due because the delayed heap of their queue was full.
+        static uint32_t get_delayed_overflows();
+        // when the next job the calling core may run becomes due, 0 while one is due and UINT64_MAX while none is pending.
+        static uint64_t get_next_wake_time();
+
+        class run_queue;
     };
 
     class work : private data_structure::node
@@ -26,23 +91,76 @@ namespace job_queue
         void activate();
         void deactivate();
 
-        void wait_done();
+        // returns once the run in progress, if any, has ended, false when it is still running after the timeout.
+        // the waiting core sleeps on wfe and the end of the run wakes it. the job's writes are visible on return,
+        // so a deactivated job can be torn down right after. it must not be called from the job itself.
+        bool wait_done(uint32_t timeout_us = UINT32_MAX);
         
         void set_affinity_mask(uint8_t affinity_mask);
+        void set_priority(uint8_t priority);
+        // relative to the time the job becomes due, 0 for none. a job that starts later counts a miss.
+        void set_deadline_us(uint32_t deadline);
         void set_pending();
         void set_pending_delay_us(uint32_t delay);
         void set_pending_at(uint64_t time);
 
+        // a job completes when a run ends without making it pending again, and then notifies its continuations.
+        // a continuation becomes pending once as many of the jobs it continues have completed as it has dependencies,
+        // or on each completion with none. set_dependencies() arms the count for one round, it is none after.
+        // a job that checks for no remaining dependencies before arming the next round cannot take a late completion
+        // of the last round into the new count, as it could by checking the jobs it continues for idle.
+        void add_continuation(work* next);
+        void set_dependencies(uint8_t count);
+        uint8_t get_remaining_dependencies() const { return m_remaining_dependencies.load_acquire(); }
+
         bool is_idle() const;
+        uint32_t get_deadline_misses() const { return m_deadline_misses; }
+
+#if JOB_STATS_ENABLE
+        void set_name(const char* name) { m_name = name; }
+        const char* get_name() const { return m_name; }
+        const job_stats& get_stats() const { return m_stats; }
+        void reset_stats();
+#else
+        void set_name(const char*) {}
+#endif
 
     protected:
         virtual void operator()() = 0;
     private:
-        uint64_t m_at;
-        uint8_t m_affinity_mask;
-        uint8_t m_running;
-        uint8_t m_pending;
-        uint8_t m_removed;
+        static constexpr uint8_t not_delayed = 0xff;
+        static constexpr uint8_t max_continuations = 2;
+        static constexpr uint8_t shared_queue = system::num_cores;
+
+        uint64_t m_at = 0;
+        uint64_t m_deadline_at = 0;
+        uint32_t m_deadline_us = 0;
+        uint32_t m_deadline_misses = 0;
+        uint8_t m_priority = priority_normal;
+        uint8_t m_affinity_mask = (1 << system::num_cores) - 1;
+        data_structure::published<uint8_t> m_running;
+        uint8_t m_pending = 0;
+        uint8_t m_active = 0;
+        uint8_t m_heap_index = not_delayed;
+        uint8_t m_queue = shared_queue;
+        data_structure::published<uint8_t> m_remaining_dependencies;
+        uint8_t m_continuation_count = 0;
+        std::array<work*, max_continuations> m_continuations = {};
+#if JOB_STATS_ENABLE
+        const char* m_name = "";
+        uint64_t m_due_at = 0;
+        work* m_next_stats_job = nullptr;
+        bool m_stats_registered = false;
+        job_stats m_stats;
+
+        void record_stats(uint64_t start, uint64_t end, uint8_t core);
+#endif
+
+        uint64_t get_deadline() const;
+        bool is_prior(const work* than) const;
+        bool is_queued() const;
+        void set_pending(uint64_t at, uint64_t deadline_at);
+        void notify_dependency();
     };
 
     class work_fn : public work
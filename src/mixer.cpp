@@ -1,6 +1,7 @@
 #include <hardware/interp.h>
 #include <pico/platform.h>
 #include <cstring>
+#include <array>
 #include <type_traits>
 #include <algorithm>
 #include "support.h"
@@ -12,99 +13,376 @@ namespace processing
     using namespace support;
 
 
-    template<uint8_t Bits, bool Overwrite> mixer::apply_result mixer::combine_with_interp(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end)
+    constexpr double constexpr_exp(double x)
     {
-        interp_set_config(interp0, 0, &m_lane0);
-        interp_set_config(interp0, 1, &m_lane1);
-        interp_set_config(interp1, 0, &m_lane2);
+        if(x < 0)
+            return 1.0/constexpr_exp(-x);
 
-        interp0->accum[1] = volume;
-        interp0->base[0] = 0;
+        // exp(x) = exp(x/2^n)^(2^n)
+        int n = 0;
+        while(x > 0.5)
+        {
+            x *= 0.5;
+            ++n;
+        }
+
+        double sum = 1.0;
+        double term = 1.0;
+        for(int i = 1; i < 16; ++i)
+        {
+            term *= x/i;
+            sum += term;
+        }
+
+        while(n-- > 0)
+            sum *= sum;
+        return sum;
+    }
+
+    constexpr double db_to_linear(double db)
+    {
+        constexpr double ln10 = 2.302585092994046;
+        return constexpr_exp(db*ln10/20.0);
+    }
+
+    // linear gain of each 1dB step from min_volume_db to max_volume_db in Q2.30
+    constexpr size_t volume_coarse_steps = (mixer::max_volume_db - mixer::min_volume_db)/256 + 1;
+    constexpr auto g_volume_coarse_table = []()
+    {
+        std::array<uint32_t, volume_coarse_steps> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+            table[i] = (uint32_t)(db_to_linear(mixer::min_volume_db/256 + (int)i)*(1<<30) + 0.5);
+        return table;
+    }();
+
+    // linear gain of each 1/256dB step within 1dB in Q2.30
+    constexpr auto g_volume_fine_table = []()
+    {
+        std::array<uint32_t, 256> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+            table[i] = (uint32_t)(db_to_linear(i/256.0)*(1<<30) + 0.5);
+        return table;
+    }();
+
+    static_assert(g_volume_coarse_table[volume_coarse_steps - 7] == (1u<<30));
+    static_assert(g_volume_fine_table[0] == (1u<<30));
+
+    uint16_t mixer::db_to_gain(int16_t volume_db)
+    {
+        if(volume_db <= min_volume_db)
+            return 0;
+        if(volume_db >= max_volume_db)
+            volume_db = max_volume_db;
 
-        interp1->base[0] = ~(((uint32_t)1<<(Bits - 1)) - 1);
-        interp1->base[1] = ((uint32_t)1<<(Bits - 1)) - 1;
+        const uint32_t index = volume_db - min_volume_db;
+        const uint64_t coarse = g_volume_coarse_table[index >> 8];
+        const uint64_t fine = g_volume_fine_table[index & 0xff];
+
+        // Q2.30 * Q2.30 -> Q1.15
+        const uint32_t gain = (uint32_t)((coarse*fine + (1ull<<44)) >> 45);
+        return (uint16_t)std::min<uint32_t>(gain, 0xffff);
+    }
+
+    int16_t mixer::gain_to_db(uint16_t gain)
+    {
+        if(gain == 0)
+            return min_volume_db;
+
+        // db_to_gain is monotonic. search the smallest volume which reaches the gain.
+        int32_t low = min_volume_db;
+        int32_t high = max_volume_db;
+        while(low < high)
+        {
+            const int32_t mid = (low + high) >> 1;
+            if(db_to_gain((int16_t)mid) < gain)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return (int16_t)low;
+    }
+
+
+    template<uint8_t Bits> inline void measure_level(mixer::meter::channel& ch, uint32_t value)
+    {
+        const int32_t signed_value = (int32_t)value;
+        uint32_t level = (uint32_t)(signed_value < 0 ? -signed_value : signed_value);
+        if constexpr (Bits > 16)
+            level >>= (Bits - 16);
+        if(level > 0xffff)
+            level = 0xffff;
+
+        if(level > ch.block_peak)
+            ch.block_peak = level;
+        ch.block_sum_squares += level*level;
+    }
+
+    static uint16_t isqrt(uint32_t value)
+    {
+        uint32_t result = 0;
+        uint32_t bit = 1u << 30;
+        while(bit > value)
+            bit >>= 2;
+
+        while(bit)
+        {
+            if(value >= result + bit)
+            {
+                value -= result + bit;
+                result = (result >> 1) + bit;
+            }
+            else
+            {
+                result >>= 1;
+            }
+            bit >>= 2;
+        }
+        return (uint16_t)std::min<uint32_t>(result, 0xffff);
+    }
+
+    void mixer::update_meter(meter& meter, const meter_config& cfg)
+    {
+        for(auto& ch : meter.channels)
+        {
+            const uint32_t block_mean_square = meter.block_frames ? (uint32_t)(ch.block_sum_squares/meter.block_frames) : 0;
+            ch.mean_square += (int32_t)(((int64_t)block_mean_square - ch.mean_square) >> cfg.rms_smoothing_shift);
+
+            auto& published = ch.published;
+            const uint16_t decayed_peak = published.peak - (published.peak >> cfg.peak_decay_shift) - (published.peak ? 1 : 0);
+            published.peak = std::max(ch.block_peak, decayed_peak);
+            published.rms = isqrt(ch.mean_square);
+
+            if(ch.block_peak >= published.peak_hold)
+            {
+                published.peak_hold = ch.block_peak;
+                ch.hold_count = cfg.hold_blocks;
+            }
+            else if(ch.hold_count)
+            {
+                --ch.hold_count;
+            }
+            else
+            {
+                published.peak_hold = published.peak;
+            }
+
+            ch.block_peak = 0;
+            ch.block_sum_squares = 0;
+        }
+        meter.block_frames = 0;
+    }
+
+    void mixer::reset_meter(meter& meter)
+    {
+        meter = {};
+    }
+
+
+    // limiter works on 24bit magnitude regardless of the sample bits.
+    constexpr uint32_t limiter_full_scale = 1u << 23;
+    constexpr uint32_t limiter_knee = limiter_full_scale/4*3;
+    constexpr uint32_t limiter_max_level = (1u << 25) - 1;
+    constexpr uint8_t limiter_knee_step_bits = 16;
+
+    // tanh curve from the knee toward full scale, sampled every 1<<limiter_knee_step_bits over the knee.
+    constexpr auto g_limiter_knee_table = []()
+    {
+        constexpr double range = limiter_full_scale - limiter_knee;
+        std::array<uint32_t, ((limiter_max_level - limiter_knee) >> limiter_knee_step_bits) + 2> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+        {
+            const double x = (double)(i << limiter_knee_step_bits)/range;
+            const double y = 1.0 - 2.0/(constexpr_exp(2.0*x) + 1.0);
+            table[i] = std::min<uint32_t>(limiter_knee + (uint32_t)(y*range + 0.5), limiter_full_scale - 1);
+        }
+        return table;
+    }();
+
+    static_assert(g_limiter_knee_table[0] == limiter_knee);
+    static_assert(g_limiter_knee_table[1] - g_limiter_knee_table[0] <= (1u << limiter_knee_step_bits));
+
+    template<uint8_t Bits> inline uint32_t limit_sum(mixer::limiter& limiter, uint32_t src_value, uint32_t dst_value)
+    {
+        using wide_t = std::conditional_t<Bits == 32, int64_t, int32_t>;
+
+        const wide_t sum = (wide_t)(int32_t)src_value + (int32_t)dst_value;
+        const bool negative = sum < 0;
+        const wide_t magnitude = negative ? -sum : sum;
+
+        uint32_t level;
+        if constexpr (Bits > 24)
+            level = (uint32_t)std::min<wide_t>(magnitude >> (Bits - 24), limiter_max_level);
+        else
+            level = (uint32_t)std::min<wide_t>(magnitude, limiter_max_level >> (24 - Bits)) << (24 - Bits);
+
+        if(level > limiter.block_peak)
+            limiter.block_peak = level;
+
+        // most samples take this path.
+        if(level <= limiter_knee && limiter.gain == mixer::unity_gain)
+            return (uint32_t)sum;
+
+        if(limiter.gain != mixer::unity_gain)
+            level = (((level >> 10)*limiter.gain) >> 5) + (((level & 0x3ff)*limiter.gain) >> 15);
+
+        if(level > limiter_knee)
+        {
+            const uint32_t over = level - limiter_knee;
+            const uint32_t index = over >> limiter_knee_step_bits;
+            const uint32_t frac = over & ((1u << limiter_knee_step_bits) - 1);
+            const uint32_t base = g_limiter_knee_table[index];
+            level = base + (((g_limiter_knee_table[index + 1] - base)*frac) >> limiter_knee_step_bits);
+        }
+
+        if constexpr (Bits > 24)
+            level <<= (Bits - 24);
+        else
+            level >>= (24 - Bits);
+
+        return negative ? (uint32_t)-(int32_t)level : level;
+    }
+
+    void mixer::update_limiter(limiter& limiter, const limiter_config& cfg)
+    {
+        // pull a sustained peak back to full scale. overshoots within a block are left to the knee.
+        uint32_t target = unity_gain;
+        if(limiter.block_peak > limiter_full_scale)
+            target = ((limiter_full_scale >> 8) << 15)/(limiter.block_peak >> 8);
+
+        if(target < limiter.gain)
+            limiter.gain = target;
+        else
+            limiter.gain = std::min<uint32_t>(target, limiter.gain + ((target - limiter.gain) >> cfg.release_shift) + 1);
+
+        limiter.block_peak = 0;
+    }
+
+    void mixer::reset_limiter(limiter& limiter)
+    {
+        limiter = { unity_gain, 0 };
+    }
+
+
+    template<uint8_t Bits, uint8_t Variant> mixer::apply_result mixer::combine_with_interp(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, meter* meter, limiter* limiter)
+    {
+        constexpr bool Overwrite = Variant & variant_overwrite;
+        constexpr bool Metering = Variant & variant_metering;
+        constexpr bool Limiting = Variant & variant_limiting;
+        constexpr bool Unity = Variant & variant_unity;
+        static_assert(!(Overwrite && Limiting));
+
+        interp_set_config(interp1, 0, &m_lane_clamp);
+
+        if constexpr (Bits < 32)
+        {
+            interp1->base[0] = ~(((uint32_t)1<<(Bits - 1)) - 1);
+            interp1->base[1] = ((uint32_t)1<<(Bits - 1)) - 1;
+        }
 
         auto src = src_begin;
         auto dst = dst_begin;
         auto stride = m_config.stride;
+        const uint8_t channels = m_config.channels;
+        uint8_t ch = 0;
 
         while(src < src_end && dst < dst_end)
         {
-            interp0->base[1] = bytes_to_dword<Bits, true>(src);
-            if constexpr (Overwrite)
+            const uint32_t src_value = Unity ? bytes_to_dword<Bits, true>(src) : apply_gain<Bits>(bytes_to_dword<Bits, true>(src), gain);
+            if constexpr (Metering)
             {
-                copy_dword<Bits>(dst, interp0->peek[1]);
+                measure_level<Bits>(meter->channels[ch], src_value);
+                if(++ch == channels)
+                    ch = 0;
             }
-            else
+            if constexpr (Limiting)
+            {
+                copy_dword<Bits>(dst, limit_sum<Bits>(*limiter, src_value, bytes_to_dword<Bits, true>(dst)));
+            }
+            else if constexpr (Bits == 32) 
             {
-                if constexpr (Bits == 32) 
+                if constexpr (Overwrite)
+                {
+                    copy_dword<Bits>(dst, src_value);
+                }
+                else
                 {
-                    auto val0 = interp0->peek[1];
-                    auto val1 = bytes_to_dword<Bits, true>(dst);
+                    const uint32_t dst_value = bytes_to_dword<Bits, true>(dst);
                     
                     uint32_t sum;
-                    if(__builtin_sadd_overflow(val0, val1, (int*)&sum))
+                    if(__builtin_sadd_overflow(src_value, dst_value, (int*)&sum))
                     {
-                        if(val0&0x80000000)
+                        if(src_value&0x80000000)
                             sum = 0x80000000;
                         else
                             sum = 0x7fffffff;
                     }
                     copy_dword<Bits>(dst, sum);
                 }
-                else
-                {
-                    interp1->accum[0] = interp0->peek[1];
+            }
+            else
+            {
+                interp1->accum[0] = src_value;
+                if constexpr (!Overwrite)
                     interp1->add_raw[0] = bytes_to_dword<Bits, true>(dst);
-                    copy_dword<Bits>(dst, interp1->peek[0]);
-                }
+                copy_dword<Bits>(dst, interp1->peek[0]);
             }
             src += stride;
             dst += stride;
         }
 
+        if constexpr (Metering)
+            meter->block_frames += (src - src_begin)/(stride*channels);
+
         return { (size_t)(src - src_begin), (size_t)(dst - dst_begin) };
     }
 
-    template<uint8_t Bits, bool Overwrite> mixer::apply_result mixer::combine(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end)
+    template<uint8_t Bits, uint8_t Variant> mixer::apply_result mixer::combine(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, meter* meter, limiter* limiter)
     {
-        interp0->accum[1] = volume;
-        interp0->base[0] = 0;
-
-        interp1->base[0] = ~(((uint32_t)1<<(Bits - 1)) - 1);
-        interp1->base[1] = ((uint32_t)1<<(Bits - 1)) - 1;
+        constexpr bool Overwrite = Variant & variant_overwrite;
+        constexpr bool Metering = Variant & variant_metering;
+        constexpr bool Limiting = Variant & variant_limiting;
+        constexpr bool Unity = Variant & variant_unity;
+        static_assert(!(Overwrite && Limiting));
 
         auto src = src_begin;
         auto dst = dst_begin;
         auto stride = m_config.stride;
+        const uint8_t channels = m_config.channels;
+        uint8_t ch = 0;
 
         while(src < src_end && dst < dst_end)
         {
-            const uint32_t src_value = blend_value<Bits, true>(0, bytes_to_dword<Bits, true>(src), volume);
+            const uint32_t src_value = Unity ? bytes_to_dword<Bits, true>(src) : apply_gain<Bits>(bytes_to_dword<Bits, true>(src), gain);
+            if constexpr (Metering)
+            {
+                measure_level<Bits>(meter->channels[ch], src_value);
+                if(++ch == channels)
+                    ch = 0;
+            }
             if constexpr (Overwrite)
             {
-                copy_dword<Bits>(dst, src_value);
+                if constexpr (Bits == 32)
+                    copy_dword<Bits>(dst, src_value);
+                else
+                    copy_dword<Bits>(dst, saturate_value<Bits>(src_value));
             }
             else
             {
                 const uint32_t dst_value = bytes_to_dword<Bits, true>(dst);
                 
                 uint32_t mixed;
-                if constexpr (Bits == 32) 
+                if constexpr (Limiting)
+                {
+                    mixed = limit_sum<Bits>(*limiter, src_value, dst_value);
+                }
+                else if constexpr (Bits == 32) 
                 {
                     if(__builtin_sadd_overflow(src_value, dst_value, (int*)&mixed))
                         mixed = (src_value&0x80000000) ? 0x80000000 : 0x7fffffff;
                 }
                 else
                 {
-                    constexpr int32_t min_value = (int32_t)(0xffffffff << (Bits - 1));
-                    constexpr int32_t max_value = (int32_t)((1 << (Bits - 1)) - 1);
-
-                    mixed = src_value + dst_value;
-                    if((int32_t)mixed > max_value)
-                        mixed = max_value;
-                    else if((int32_t)mixed < min_value)
-                        mixed = min_value;
+                    mixed = saturate_value<Bits>(src_value + dst_value);
                 }
                 copy_dword<Bits>(dst, mixed);
             }
@@ -112,20 +390,25 @@ namespace processing
             dst += stride;
         }
 
+        if constexpr (Metering)
+            meter->block_frames += (src - src_begin)/(stride*channels);
+
         return { (size_t)(src - src_begin), (size_t)(dst - dst_begin) };
     }
 
-    template<bool Overwrite>
+    template<uint8_t Variant>
     mixer::fn_combine_t mixer::get_combine_method(const config& cfg)
     {
-        if(cfg.use_interp)
+        if constexpr ((Variant & variant_overwrite) && (Variant & variant_limiting))
+            return nullptr;
+        else if(cfg.use_interp)
         {
             switch(cfg.bits)
             {
-                case 16: return &mixer::combine_with_interp<16, Overwrite>;
-                case 20: return &mixer::combine_with_interp<20, Overwrite>;
-                case 24: return &mixer::combine_with_interp<24, Overwrite>;
-                case 32: return &mixer::combine_with_interp<32, Overwrite>;
+                case 16: return &mixer::combine_with_interp<16, Variant>;
+                case 20: return &mixer::combine_with_interp<20, Variant>;
+                case 24: return &mixer::combine_with_interp<24, Variant>;
+                case 32: return &mixer::combine_with_interp<32, Variant>;
                 default:
                     dbg_assert(false && "unsupproted bits");
             }
@@ -134,10 +417,10 @@ namespace processing
         {
             switch(cfg.bits)
             {
-                case 16: return &mixer::combine<16, Overwrite>;
-                case 20: return &mixer::combine<20, Overwrite>;
-                case 24: return &mixer::combine<24, Overwrite>;
-                case 32: return &mixer::combine<32, Overwrite>;
+                case 16: return &mixer::combine<16, Variant>;
+                case 20: return &mixer::combine<20, Variant>;
+                case 24: return &mixer::combine<24, Variant>;
+                case 32: return &mixer::combine<32, Variant>;
                 default:
                     dbg_assert(false && "unsupproted bits");
             }
@@ -152,24 +435,23 @@ namespace processing
         
         if(cfg.use_interp)
         {
-            m_lane0 =  interp_default_config();
-            interp_config_set_blend(&m_lane0, true);
+            m_lane_clamp = interp_default_config();
+            interp_config_set_clamp(&m_lane_clamp, true);
+            interp_config_set_signed(&m_lane_clamp, true);
+        }
 
-            m_lane1 = interp_default_config();
-            interp_config_set_signed(&m_lane1, true);
+        dbg_assert(cfg.channels <= max_meter_channels);
 
-            m_lane2 = interp_default_config();
-            interp_config_set_clamp(&m_lane2, true);
-            interp_config_set_signed(&m_lane2, true);
-            interp_config_set_add_raw(&m_lane2, true);
-        }
+        setup_combine_methods(m_config, std::make_index_sequence<variant_num>());
+    }
 
-        //m_lane3 = interp_default_config();
-        m_fn_combine = get_combine_method<false>(m_config);
-        m_fn_combine_ow = get_combine_method<true>(m_config);
+    template<size_t... Variants>
+    void mixer::setup_combine_methods(const config& cfg, std::index_sequence<Variants...>)
+    {
+        ((m_fn_combine[Variants] = get_combine_method<Variants>(cfg)), ...);
     }
 
-    mixer::apply_result mixer::apply(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, bool overwrite)
+    mixer::apply_result mixer::apply(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, bool overwrite, meter* meter, limiter* limiter)
     {
         const auto stride = m_config.stride*m_config.channels;
 
@@ -181,8 +463,30 @@ namespace processing
         dst_end = dst_begin + (dst_end - dst_begin)/stride*stride;
         src_end = src_begin + (src_end - src_begin)/stride*stride;
 
-        return overwrite
-            ? (this->*m_fn_combine_ow)(volume, src_begin, src_end, dst_begin, dst_end)
-            : (this->*m_fn_combine)(volume, src_begin, src_end, dst_begin, dst_end);
+        // muted and plain copies don't need to touch each sample.
+        if(gain == 0 || (gain == unity_gain && overwrite && !meter))
+        {
+            const size_t bytes = std::min(src_end - src_begin, dst_end - dst_begin);
+            if(gain != 0)
+                std::memcpy(dst_begin, src_begin, bytes);
+            else if(overwrite)
+                std::memset(dst_begin, 0, bytes);
+
+            if(meter)
+                meter->block_frames += bytes/stride;
+            return { bytes, bytes };
+        }
+
+        uint8_t variant = 0;
+        if(overwrite)
+            variant |= variant_overwrite;
+        else if(limiter)
+            variant |= variant_limiting;    // nothing is summed on overwrite
+        if(meter)
+            variant |= variant_metering;
+        if(gain == unity_gain)
+            variant |= variant_unity;
+
+        return (this->*m_fn_combine[variant])(gain, src_begin, src_end, dst_begin, dst_end, meter, limiter);
     }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <utility>
 #include <hardware/interp.h>
 
 namespace processing
@@ -23,26 +24,92 @@ public:
         bool use_interp;
     };
 
+    // gain is unsigned Q1.15. volume is 1/256 dB step same as UAC2 volume control.
+    static constexpr uint16_t unity_gain = 0x8000;
+    static constexpr int16_t min_volume_db = -127*256;
+    static constexpr int16_t max_volume_db = 6*256;
+
+    // levels are scaled to 16bits. 0x8000 is full scale.
+    static constexpr uint8_t max_meter_channels = 2;
+
+    struct level
+    {
+        uint16_t peak;
+        uint16_t peak_hold;
+        uint16_t rms;
+    };
+
+    // accumulated by apply() through a block, and published by update_meter() per block.
+    struct meter
+    {
+        struct channel
+        {
+            uint16_t block_peak;
+            uint64_t block_sum_squares;
+            uint32_t mean_square;
+            uint16_t hold_count;
+            level    published;
+        };
+
+        channel  channels[max_meter_channels];
+        uint32_t block_frames;
+    };
+
+    struct meter_config
+    {
+        uint8_t  peak_decay_shift;
+        uint8_t  rms_smoothing_shift;
+        uint16_t hold_blocks;
+    };
+
+    // soft knee limiter for accumulation. samples over the knee are bent toward full scale,
+    // and the gain is reduced per block while the sum keeps exceeding full scale.
+    struct limiter
+    {
+        uint16_t gain;
+        uint32_t block_peak;
+    };
+
+    struct limiter_config
+    {
+        uint8_t release_shift;
+    };
+
+    static uint16_t db_to_gain(int16_t volume_db);
+    static int16_t gain_to_db(uint16_t gain);
+    static void update_meter(meter& meter, const meter_config& cfg);
+    static void reset_meter(meter& meter);
+    static void update_limiter(limiter& limiter, const limiter_config& cfg);
+    static void reset_limiter(limiter& limiter);
+
     void setup(const config&);
-    apply_result apply(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, bool overwrite);
+    apply_result apply(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, bool overwrite, meter* meter = nullptr, limiter* limiter = nullptr);
 
 private:
-    using fn_combine_t = apply_result(mixer::*)(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end);
+    using fn_combine_t = apply_result(mixer::*)(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, meter* meter, limiter* limiter);
+
+    // kernel variants. limiting is never combined with overwrite.
+    enum : uint8_t
+    {
+        variant_overwrite = 1 << 0,
+        variant_metering  = 1 << 1,
+        variant_limiting  = 1 << 2,
+        variant_unity     = 1 << 3,
+        variant_num       = 1 << 4
+    };
 
     config m_config;
-    interp_config m_lane0;
-    interp_config m_lane1;
-    interp_config m_lane2;
-    //interp_config lane3;
-    fn_combine_t m_fn_combine;
-    fn_combine_t m_fn_combine_ow;
-
-    template<uint8_t Bits, bool Overwrite> 
-        apply_result combine_with_interp(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end);
-    template<uint8_t Bits, bool Overwrite> 
-        apply_result combine(uint8_t volume, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end);
-    template<bool Overwrite>
+    interp_config m_lane_clamp;
+    fn_combine_t m_fn_combine[variant_num];
+
+    template<uint8_t Bits, uint8_t Variant>
+        apply_result combine_with_interp(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, meter* meter, limiter* limiter);
+    template<uint8_t Bits, uint8_t Variant>
+        apply_result combine(uint16_t gain, const uint8_t* src_begin, const uint8_t* src_end, uint8_t* dst_begin, uint8_t* dst_end, meter* meter, limiter* limiter);
+    template<uint8_t Variant>
         fn_combine_t get_combine_method(const config& cfg);
+    template<size_t... Variants>
+        void setup_combine_methods(const config& cfg, std::index_sequence<Variants...>);
 };
 
 }
\ No newline at end of file
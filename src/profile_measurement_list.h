@@ -7,12 +7,16 @@ enum
     PROF_MIXOUT_USBDATA,
     PROF_MIXOUT_LINEIN_FETCH,
     PROF_MIXOUT_LINEIN_MIX,
+    PROF_MIXOUT_EQ,
+    PROF_MIXOUT_CROSSFADE,
     PROF_MIXOUT_SPDIF_WRITE,
     PROF_MIXOUT_DAC_WRITE,
     PROF_MIXIN_ADC_FETCH,
-    PROF_MIXIN_ADC_MIX,
+    PROF_MIXIN_ADC_DYNAMICS,
     PROF_MIXIN_SPDIF_FETCH,
-    PROF_MIXIN_SPDIF_MIX,
+    PROF_MIXIN_LOOPBACK_FETCH,
+    PROF_MIXIN_MIX,
+    PROF_SPECTRUM,
     PROF_CONV_IP_APPLY,
     PROF_CONV_APPLY,
     PROF_DWSMP_IP_SETUP,
@@ -0,0 +1,287 @@
+#include <pico/platform.h>
+#include <array>
+#include <algorithm>
+#include "support.h"
+#include "debug.h"
+#include "spectrum.h"
+
+namespace processing
+{
+    using namespace support;
+
+    constexpr double pi = 3.141592653589793;
+
+    constexpr double constexpr_cos(double x)
+    {
+        // reduce to [-pi, pi] for the series.
+        while(x > pi)
+            x -= 2*pi;
+        while(x < -pi)
+            x += 2*pi;
+
+        double sum = 0.0;
+        double term = 1.0;
+        for(int i = 1; i < 20; ++i)
+        {
+            sum += term;
+            term *= -x*x/((2*i - 1)*(2*i));
+        }
+        return sum;
+    }
+
+    constexpr double constexpr_log2_1p(double x)
+    {
+        // ln(1 + x) = 2*atanh(x/(2 + x))
+        const double y = x/(2.0 + x);
+        double sum = 0.0;
+        double term = y;
+        for(int i = 0; i < 20; ++i)
+        {
+            sum += term/(2*i + 1);
+            term *= y*y;
+        }
+        constexpr double ln2 = 0.6931471805599453;
+        return 2.0*sum/ln2;
+    }
+
+    // cos(2*pi*i/max_points) in Q15. sin is read a quarter period later.
+    constexpr auto g_cos_table = []()
+    {
+        std::array<int16_t, spectrum::max_points> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+            table[i] = (int16_t)std::clamp<double>(constexpr_cos(2*pi*i/spectrum::max_points)*32768.0 + (i < spectrum::max_points/2 ? 0.5 : -0.5), -32768.0, 32767.0);
+        return table;
+    }();
+
+    // hann window over max_points in Q15. smaller transforms read it by a stride.
+    constexpr auto g_window_table = []()
+    {
+        std::array<uint16_t, spectrum::max_points> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+            table[i] = (uint16_t)((0.5 - 0.5*constexpr_cos(2*pi*i/spectrum::max_points))*32768.0 + 0.5);
+        return table;
+    }();
+
+    // log2(1 + i/256) in Q8
+    constexpr auto g_log2_table = []()
+    {
+        std::array<uint8_t, 256> table = {};
+        for(size_t i = 0; i < table.size(); ++i)
+            table[i] = (uint8_t)std::min(constexpr_log2_1p(i/256.0)*256.0 + 0.5, 255.0);
+        return table;
+    }();
+
+    static_assert(g_cos_table[0] == 32767);
+    static_assert(g_cos_table[spectrum::max_points/4] == 0);
+    static_assert(g_window_table[spectrum::max_points/2] == 32768);
+
+    // a full scale sine through the window and the scaled transform has 1/4 of its amplitude in a bin.
+    constexpr int32_t full_scale_log2_power_q8 = 26*256;
+    // 10*log10(2) in Q8
+    constexpr int32_t db_per_log2 = 771;
+
+    static inline int16_t saturate16(int32_t value)
+    {
+        return (int16_t)std::clamp<int32_t>(value, -32768, 32767);
+    }
+
+    static inline int16_t power_to_db(uint32_t power)
+    {
+        if(power == 0)
+            return spectrum::min_level_db;
+
+        const int32_t msb = 31 - __builtin_clz(power);
+        const uint32_t mantissa = msb >= 8 ? power >> (msb - 8) : power << (8 - msb);
+        const int32_t log2_q8 = msb*256 + g_log2_table[mantissa & 0xff];
+        const int32_t db = ((log2_q8 - full_scale_log2_power_q8)*db_per_log2) >> 8;
+        return (int16_t)std::clamp<int32_t>(db, spectrum::min_level_db, INT16_MAX);
+    }
+
+    template<uint8_t Bits>
+    void spectrum::capture_samples(const uint8_t* begin, const uint8_t* end, uint8_t channels)
+    {
+        constexpr uint8_t stride = bits_to_bytes(Bits);
+        const size_t frame_bytes = stride*channels;
+
+        auto position = m_position;
+        for(auto p = begin; p + frame_bytes <= end && position < m_points; )
+        {
+            int32_t sum = 0;
+            for(uint8_t ch = 0; ch < channels; ++ch)
+            {
+                int32_t value = (int32_t)bytes_to_dword<Bits, true>(p);
+                if constexpr (Bits > 16)
+                    value >>= (Bits - 16);
+                sum += value;
+                p += stride;
+            }
+            m_real[position++] = saturate16(sum/channels);
+        }
+
+        m_position = position;
+        if(position == m_points)
+            m_state = STATE_CAPTURED;
+    }
+
+    void spectrum::setup(uint16_t points)
+    {
+        dbg_assert(points >= 16 && points <= max_points && (points & (points - 1)) == 0 && (__builtin_ctz(points) & 1) == 0);
+
+        m_state = STATE_IDLE;
+        m_points = points;
+        m_position = 0;
+        std::fill(m_bins, m_bins + max_bins, min_level_db);
+    }
+
+    void spectrum::arm()
+    {
+        m_position = 0;
+        m_state = STATE_CAPTURING;
+    }
+
+    void spectrum::capture(const uint8_t* begin, const uint8_t* end, uint8_t bits, uint8_t channels)
+    {
+        if(m_state != STATE_CAPTURING)
+            return;
+
+        switch(bits)
+        {
+            case 16: capture_samples<16>(begin, end, channels); break;
+            case 24: capture_samples<24>(begin, end, channels); break;
+            case 32: capture_samples<32>(begin, end, channels); break;
+        }
+    }
+
+    void spectrum::begin_transform()
+    {
+        const uint16_t window_stride = max_points/m_points;
+        for(uint16_t i = 0; i < m_points; ++i)
+        {
+            m_real[i] = (int16_t)(((int32_t)m_real[i]*g_window_table[i*window_stride]) >> 15);
+            m_imag[i] = 0;
+        }
+
+        m_stage_span = m_points;
+        m_butterfly = 0;
+        m_state = STATE_TRANSFORMING;
+    }
+
+    // decimation in frequency. each stage scales by 1/4 so that the result stays in 16bit.
+    void spectrum::run_butterflies(uint16_t count)
+    {
+        const uint16_t butterflies_per_stage = m_points/4;
+
+        while(count > 0 && m_stage_span >= 4)
+        {
+            const uint16_t quarter = m_stage_span/4;
+            const uint16_t twiddle_stride = max_points/m_stage_span;
+            const uint16_t end = std::min<uint16_t>(butterflies_per_stage, m_butterfly + count);
+            count -= end - m_butterfly;
+
+            for(uint16_t b = m_butterfly; b < end; ++b)
+            {
+                const uint16_t j = b % quarter;
+                const uint16_t i0 = (b/quarter)*m_stage_span + j;
+                const uint16_t i1 = i0 + quarter;
+                const uint16_t i2 = i1 + quarter;
+                const uint16_t i3 = i2 + quarter;
+
+                const int32_t t0r = m_real[i0] + m_real[i2], t0i = m_imag[i0] + m_imag[i2];
+                const int32_t t1r = m_real[i0] - m_real[i2], t1i = m_imag[i0] - m_imag[i2];
+                const int32_t t2r = m_real[i1] + m_real[i3], t2i = m_imag[i1] + m_imag[i3];
+                const int32_t t3r = m_real[i1] - m_real[i3], t3i = m_imag[i1] - m_imag[i3];
+
+                m_real[i0] = (int16_t)((t0r + t2r) >> 2);
+                m_imag[i0] = (int16_t)((t0i + t2i) >> 2);
+
+                const int32_t y[3][2] = {
+                    {(t1r + t3i) >> 2, (t1i - t3r) >> 2},
+                    {(t0r - t2r) >> 2, (t0i - t2i) >> 2},
+                    {(t1r - t3i) >> 2, (t1i + t3r) >> 2}};
+                const uint16_t index[3] = {i1, i2, i3};
+
+                for(uint8_t k = 0; k < 3; ++k)
+                {
+                    const uint16_t w = ((k + 1)*j*twiddle_stride) & (max_points - 1);
+                    const int32_t c = g_cos_table[w];
+                    const int32_t s = g_cos_table[(w + max_points*3/4) & (max_points - 1)];
+                    m_real[index[k]] = saturate16((y[k][0]*c + y[k][1]*s) >> 15);
+                    m_imag[index[k]] = saturate16((y[k][1]*c - y[k][0]*s) >> 15);
+                }
+            }
+
+            m_butterfly = end;
+            if(m_butterfly == butterflies_per_stage)
+            {
+                m_stage_span /= 4;
+                m_butterfly = 0;
+            }
+        }
+
+        if(m_stage_span < 4)
+        {
+            reverse_digits();
+            m_position = 0;
+            m_state = STATE_MEASURING;
+        }
+    }
+
+    void spectrum::reverse_digits()
+    {
+        const uint8_t digits = __builtin_ctz(m_points)/2;
+        for(uint16_t i = 0; i < m_points; ++i)
+        {
+            uint16_t r = 0;
+            for(uint16_t v = i, d = 0; d < digits; ++d, v >>= 2)
+                r = (r << 2) | (v & 3);
+
+            if(r > i)
+            {
+                std::swap(m_real[i], m_real[r]);
+                std::swap(m_imag[i], m_imag[r]);
+            }
+        }
+    }
+
+    void spectrum::measure_bins(uint16_t count)
+    {
+        const uint16_t end = std::min<uint16_t>(get_bin_count(), m_position + count);
+        for(uint16_t i = m_position; i < end; ++i)
+        {
+            const int32_t re = m_real[i];
+            const int32_t im = m_imag[i];
+            m_bins[i] = power_to_db((uint32_t)(re*re) + (uint32_t)(im*im));
+        }
+
+        m_position = end;
+        if(m_position == get_bin_count())
+            m_state = STATE_IDLE;
+    }
+
+    bool spectrum::process(uint16_t max_butterflies)
+    {
+        switch(m_state)
+        {
+            case STATE_CAPTURED:
+                begin_transform();
+                break;
+            case STATE_TRANSFORMING:
+                run_butterflies(max_butterflies);
+                break;
+            case STATE_MEASURING:
+                measure_bins(max_butterflies);
+                return m_state == STATE_IDLE;
+            default:
+                break;
+        }
+        return false;
+    }
+
+    uint16_t spectrum::get_bins(int16_t* bins, uint16_t max_count) const
+    {
+        const uint16_t count = std::min(get_bin_count(), max_count);
+        std::copy(m_bins, m_bins + count, bins);
+        return count;
+    }
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace processing
+{
+
+// log magnitude spectrum with a radix-4 fixed-point fft. the transform runs by slices of butterflies,
+// so that a low priority job can spread it over spare cycles.
+class spectrum
+{
+public:
+    static constexpr uint16_t max_points = 1024;
+    static constexpr uint16_t max_bins = max_points/2;
+    // bins are 1/256 dB step. 0dB is a full scale sine.
+    static constexpr int16_t min_level_db = -127*256;
+
+    enum state : uint8_t
+    {
+        STATE_IDLE,
+        STATE_CAPTURING,
+        STATE_CAPTURED,
+        STATE_TRANSFORMING,
+        STATE_MEASURING
+    };
+
+    // points is 256 or 1024, powers of 4.
+    void setup(uint16_t points);
+    uint16_t get_points() const { return m_points; }
+    uint16_t get_bin_count() const { return m_points/2; }
+    state get_state() const { return m_state; }
+
+    // starts filling the window from the next capture().
+    void arm();
+    // called from the audio jobs. takes a mono mixdown of interleaved samples while capturing.
+    void capture(const uint8_t* begin, const uint8_t* end, uint8_t bits, uint8_t channels);
+    // runs up to max_butterflies butterflies, or as many bins. returns true when the bins have been published.
+    bool process(uint16_t max_butterflies);
+
+    uint16_t get_bins(int16_t* bins, uint16_t max_count) const;
+
+private:
+    volatile state m_state = STATE_IDLE;
+    uint16_t m_points = 0;
+    uint16_t m_position = 0;
+    uint16_t m_stage_span = 0;
+    uint16_t m_butterfly = 0;
+    int16_t m_real[max_points];
+    int16_t m_imag[max_points];
+    int16_t m_bins[max_bins];
+
+    template<uint8_t Bits>
+        void capture_samples(const uint8_t* begin, const uint8_t* end, uint8_t channels);
+    void begin_transform();
+    void run_butterflies(uint16_t count);
+    void reverse_digits();
+    void measure_bins(uint16_t count);
+};
+
+}
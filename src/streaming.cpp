@@ -3,6 +3,8 @@
 #include <memory>
 #include <algorithm>
 #include <hardware/timer.h>
+#include <hardware/clocks.h>
+#include <pico/sync.h>
 #include "tusb.h"
 #include "device_config.h"
 
@@ -15,6 +17,10 @@
 #include "circular_buffer.h"
 #include "converter.h"
 #include "mixer.h"
+#include "crossfade.h"
+#include "equalizer.h"
+#include "dynamics.h"
+#include "spectrum.h"
 #include "streaming.h"
 #include "streaming_internal.h"
 #include "streaming_adc_in.h"
@@ -79,29 +85,205 @@ namespace streaming
     static constexpr uint16_t input_mixing_buffer_duration = 16;
     static constexpr uint16_t input_mixing_processing_buffer_duration_per_cycle = input_mixing_buffer_duration / 4;
     static constexpr uint16_t output_mixing_processing_buffer_duration_per_cycle = device_buffer_duration / 4;
-
-    static circular_buffer<container_array<uint8_t, max_output_samples_1ms * device_buffer_duration * sizeof(uint32_t)>> g_rx_stream_buffer;
-    static uint8_t *g_rx_stream_buffer_write_addr;
-    static const uint8_t *g_rx_stream_buffer_read_addr;
+    // the write jobs continue into the output job, and the read jobs into the input job.
+    static constexpr uint8_t output_write_job_num = DAC_OUTPUT_ENABLE + SPDIF_OUTPUT_ENABLE;
+    static constexpr uint8_t input_read_job_num = ADC_INPUT_ENABLE + SPDIF_INPUT_ENABLE;
+    // how late a mixing job may start once due, half of the shortest processing cycle.
+    static constexpr uint32_t audio_job_deadline_us = output_mixing_processing_buffer_duration_per_cycle * 1000 / 2;
+
+    // the guard tail covers a whole processing block, so the output job reads each block in place.
+    // the timestamps sample the host's write rate over a little more than 100ms.
+    static constexpr size_t rx_stream_timestamps = 16;
+    static constexpr uint32_t rx_stream_timestamp_interval_us = 8000;
+    static masked_circular_buffer<uint8_t,
+        round_up_pow2(max_output_samples_1ms * device_buffer_duration * sizeof(uint32_t)),
+        max_output_samples_1ms * output_mixing_processing_buffer_duration_per_cycle * sizeof(uint32_t),
+        rx_stream_timestamps> g_rx_stream_buffer;
 
     static uint32_t g_output_sampling_frequency = 0;
     static uint8_t g_output_resolution_bits = 0;
     static uint32_t g_input_sampling_frequency = 0;
     static uint8_t g_input_resolution_bits = 0;
     static processing::mixer g_input_mixer;
-    static uint8_t g_input_mixer_adc_volume = 0xff;
-    static uint8_t g_input_mixer_spdif_volume = 0xff;
-    static circular_buffer<container_array<uint8_t, max_input_samples_1ms * input_mixing_buffer_duration * sizeof(uint32_t)>> g_input_mixing_buffer;
-    static uint8_t *g_input_mixing_buffer_write_addr;
-    static const uint8_t *g_input_mixing_buffer_pop_tx_read_addr;
-    static const uint8_t *g_input_mixing_buffer_output_read_addr;
+    static int16_t g_input_mixer_adc_volume_db = 0;
+    static int16_t g_input_mixer_spdif_volume_db = 0;
+    static uint16_t g_input_mixer_adc_gain = processing::mixer::unity_gain;
+    static uint16_t g_input_mixer_spdif_gain = processing::mixer::unity_gain;
     static bool g_input_mixing_task_active;
     static processing::mixer g_output_mixer;
-    static processing::converter g_output_input_converter;
-    static uint8_t g_output_mixer_rx_volume = 0xff;
-    static uint8_t g_output_mixer_mixed_input_volume = 0xff;
     static bool g_output_process_task_active;
     static uint8_t g_output_device_charge_count = 0;
+    static bool g_level_meter_enabled = false;
+    static std::array<processing::mixer::meter, LEVEL_METER_SOURCE_NUM> g_level_meters;
+
+    // about 20dB/s peak fall, 1s hold and 300ms rms integration per processing cycle.
+    static constexpr processing::mixer::meter_config input_level_meter_config = {
+        .peak_decay_shift = 7,
+        .rms_smoothing_shift = 6,
+        .hold_blocks = 1000 / input_mixing_processing_buffer_duration_per_cycle};
+    static constexpr processing::mixer::meter_config output_level_meter_config = {
+        .peak_decay_shift = 8,
+        .rms_smoothing_shift = 7,
+        .hold_blocks = 1000 / output_mixing_processing_buffer_duration_per_cycle};
+    static bool g_limiter_enabled = true;
+
+    // about 60ms release for both.
+    static constexpr processing::mixer::limiter_config input_limiter_config = {
+        .release_shift = 4};
+    static constexpr processing::mixer::limiter_config output_limiter_config = {
+        .release_shift = 5};
+
+
+    // bus 0 is sent to USB IN. the others only carry a different input mix to an output sink.
+    static constexpr uint8_t max_input_mixing_buses = 3;
+    // sinks before ROUTE_SINK_USB_IN are processed by the output job.
+    static constexpr uint8_t output_sink_num = ROUTE_SINK_USB_IN;
+
+    // the input job writes the buses, the output job and the USB IN callback read them on either core.
+    enum input_bus_reader : uint8_t
+    {
+        INPUT_BUS_READER_OUTPUT,
+        INPUT_BUS_READER_USB_IN,
+        INPUT_BUS_READER_NUM
+    };
+
+    struct input_mixing_bus
+    {
+        // the timestamps tell pop_tx_data() when the block it sends was mixed.
+        multi_reader_circular_buffer<container_array<uint8_t, max_input_samples_1ms * input_mixing_buffer_duration * sizeof(uint32_t)>, INPUT_BUS_READER_NUM, 8> buffer;
+        processing::converter output_converter;
+        processing::mixer::limiter limiter;
+        // silence written just before the write position. the output job skips the bus while it reads only this.
+        published<size_t> silent_bytes;
+    };
+
+    static std::array<input_mixing_bus, max_input_mixing_buses> g_input_mixing_buses;
+    static std::array<processing::mixer::limiter, output_sink_num> g_output_limiters;
+
+    using output_process_buffer = std::array<uint8_t, max_output_samples_1ms * output_mixing_processing_buffer_duration_per_cycle * sizeof(uint32_t)>;
+    static std::array<output_process_buffer, output_sink_num> g_output_mix_bufs;
+
+    // the outgoing stream of a transition is the last block played backward from its end,
+    // so it continues from the last sample while it fades out under the new stream.
+    // the fade is never longer than that block, or the new stream would fade in against silence after it.
+    static constexpr uint16_t max_transition_frames = 256;
+    static uint16_t g_transition_frames = 64;
+
+    struct output_transition
+    {
+        processing::crossfade crossfade;
+        std::array<int32_t, max_transition_frames * device_output_channels> tail;
+        uint32_t tail_frames;
+    };
+
+    static std::array<output_transition, output_sink_num> g_output_transitions;
+
+    // the control side stages the coefficients and the output job takes them at the start of a block.
+    struct output_eq_staging
+    {
+        std::array<processing::equalizer::section, processing::equalizer::max_sections> sections;
+        uint8_t count;
+        volatile bool pending;
+    };
+
+    static_assert(max_output_eq_sections == processing::equalizer::max_sections);
+    static std::array<processing::equalizer, output_sink_num> g_output_equalizers;
+    static output_eq_staging g_output_eq_staging = {};
+    static critical_section g_output_eq_critical_section;
+
+    // the equalizer may take this share of a core, summed over the sinks it runs on. sections over the limit of
+    // the current format and routing are staged but not applied, so the host cannot starve the output job.
+    static constexpr uint32_t output_eq_budget_percent = 40;
+
+    // the cycles one section takes per sample at each output resolution, measured once at init.
+    struct output_eq_section_cost
+    {
+        uint8_t bits;
+        uint32_t cycles_per_sample;
+    };
+    static std::array<output_eq_section_cost, 2> g_output_eq_section_costs = {{{16, 0}, {24, 0}}};
+    static uint8_t g_output_eq_max_sections = max_output_eq_sections;
+
+    // same as the equalizer, the parameters are taken by the adc fetch at the start of a block.
+    struct line_in_dynamics_staging
+    {
+        processing::dynamics::parameters parameters;
+        bool reset;
+        volatile bool pending;
+    };
+
+    static processing::dynamics g_line_in_dynamics;
+    static bool g_line_in_dynamics_enabled = false;
+    static line_in_dynamics_staging g_line_in_dynamics_staging = {};
+    static critical_section g_line_in_dynamics_critical_section;
+
+    // the audio jobs only copy into the window. the transform runs by slices in a job on core 0,
+    // since core 1 takes the spdif in decoding, and each slice is short enough not to hold the audio jobs.
+    static constexpr uint16_t spectrum_slice_butterflies = 64;
+    static constexpr uint32_t spectrum_slice_interval_us = 500;
+    static constexpr uint32_t spectrum_refresh_interval_us = 50000;
+
+    static processing::spectrum g_spectrum;
+    static job_queue::work_fn g_job_spectrum;
+    static bool g_spectrum_enabled = false;
+    static uint8_t g_spectrum_source = SPECTRUM_SOURCE_USB_IN;
+    static uint16_t g_spectrum_points = 256;
+
+    // playback stream kept for USB OUT to USB IN routing.
+    // the guard tail covers a frame, so the converter never sees a sample split at the seam.
+    static masked_circular_buffer<uint8_t,
+        round_up_pow2(max_output_samples_1ms * device_buffer_duration * sizeof(uint32_t)),
+        sizeof(uint32_t) * device_output_channels> g_loopback_buffer;
+    static processing::converter g_loopback_converter;
+    static std::array<uint8_t, max_input_samples_1ms * input_mixing_processing_buffer_duration_per_cycle * sizeof(uint32_t)> g_loopback_fetch_buffer;
+
+    // routing matrix compiled into the passes the jobs run. muted crosspoints don't appear in it.
+    struct routing_plan
+    {
+        struct input_pass
+        {
+            uint8_t source;
+            uint8_t bus;
+            uint16_t gain;
+        };
+        struct output_sink
+        {
+            bool usb_out;
+            uint16_t usb_out_gain;
+            int8_t monitor_bus;
+            int8_t shared_sink;
+        };
+
+        std::array<input_pass, ROUTE_SOURCE_NUM * max_input_mixing_buses> input_passes;
+        uint8_t input_pass_count;
+        uint8_t input_bus_count;
+        bool loopback;
+        std::array<output_sink, output_sink_num> output_sinks;
+    };
+
+    // crosspoint volumes in 1/256 dB. the default is the graph this device always had.
+    static std::array<std::array<int16_t, ROUTE_SINK_NUM>, ROUTE_SOURCE_NUM> g_route_volume_db = []()
+    {
+        constexpr int16_t monitor_volume_db = MIXING_INPUT_TO_OUTPUT_ENABLE ? 0 : processing::mixer::min_volume_db;
+
+        std::array<std::array<int16_t, ROUTE_SINK_NUM>, ROUTE_SOURCE_NUM> volumes;
+        volumes[ROUTE_SOURCE_USB_OUT] = {0, 0, processing::mixer::min_volume_db};
+        volumes[ROUTE_SOURCE_LINE_IN] = {monitor_volume_db, monitor_volume_db, 0};
+        volumes[ROUTE_SOURCE_SPDIF_IN] = {monitor_volume_db, monitor_volume_db, 0};
+        return volumes;
+    }();
+    static routing_plan g_routing_plan = {};
+
+    // which sinks share a mix follows their gains, so it changes without the topology. the control side stages it
+    // and the output job takes it between blocks, like the equalizer.
+    struct output_sharing_staging
+    {
+        std::array<int8_t, output_sink_num> shared_sinks;
+        volatile bool pending;
+    };
+
+    static output_sharing_staging g_output_sharing_staging = {};
+    static critical_section g_output_sharing_critical_section;
 
     static job_mix_out_info g_job_mix_out = {};
 #if DAC_OUTPUT_ENABLE
@@ -143,6 +325,7 @@ namespace streaming
     {
         uint32_t received_bytes;
         uint32_t transfar_bytes;
+        uint32_t transfar_max_latency_us;
         struct
         {
             uint32_t src_left;
@@ -172,6 +355,13 @@ namespace streaming
             .channels = device_input_channels,
             .use_interp = true};
         g_input_mixer.setup(mixer_config);
+
+        processing::dynamics::config dynamics_config = {
+            .bits = g_input_resolution_bits,
+            .stride = bits_to_bytes(g_input_resolution_bits),
+            .channels = device_input_channels,
+            .sampling_frequency = g_input_sampling_frequency};
+        g_line_in_dynamics.setup(dynamics_config);
     }
 
     void update_output_mixer()
@@ -190,7 +380,20 @@ namespace streaming
             .dst_freq = g_output_sampling_frequency,
             .channels = device_output_channels,
             .use_interp = true};
-        g_output_input_converter.setup(conversion_config);
+        for (auto &bus : g_input_mixing_buses)
+            bus.output_converter.setup(conversion_config);
+
+        static_assert(device_output_channels == device_input_channels);
+        processing::converter::config loopback_config = {
+            .src_bits = g_output_resolution_bits,
+            .src_stride = bits_to_bytes(g_output_resolution_bits),
+            .src_freq = g_output_sampling_frequency,
+            .dst_bits = g_input_resolution_bits,
+            .dst_stride = bits_to_bytes(g_input_resolution_bits),
+            .dst_freq = g_input_sampling_frequency,
+            .channels = device_input_channels,
+            .use_interp = true};
+        g_loopback_converter.setup(loopback_config);
 
         processing::mixer::config mixer_config = {
             .bits = g_output_resolution_bits,
@@ -200,10 +403,96 @@ namespace streaming
         g_output_mixer.setup(mixer_config);
     }
 
+    static void update_output_crossfades()
+    {
+        processing::crossfade::config crossfade_config = {
+            .bits = g_output_resolution_bits,
+            .stride = bits_to_bytes(g_output_resolution_bits),
+            .channels = device_output_channels};
+        for (auto &transition : g_output_transitions)
+            transition.crossfade.setup(crossfade_config);
+    }
+
+    // all sections and one section over the same chunk, the fastest of a few runs each so an interrupt or a cache miss
+    // does not count. the difference leaves out the unpacking and packing, which a chunk pays once whatever the count.
+    static uint32_t measure_output_eq_section_cycles_per_sample(uint8_t bits)
+    {
+        constexpr uint32_t measure_frames = 32;
+        constexpr uint8_t measure_runs = 3;
+        static processing::equalizer eq;
+        static std::array<uint8_t, measure_frames * device_output_channels * sizeof(uint32_t)> samples;
+        static std::array<processing::equalizer::section, max_output_eq_sections> sections;
+
+        const processing::equalizer::config eq_config = {
+            .bits = bits,
+            .stride = bits_to_bytes(bits),
+            .channels = device_output_channels};
+        eq.setup(eq_config);
+        sections.fill({1 << 30, 0, 0, 0, 0});
+        std::fill(samples.begin(), samples.end(), 0);
+
+        auto measure_us = [&](uint8_t count) {
+            eq.set_sections(sections.data(), count);
+            uint32_t min_us = UINT32_MAX;
+            for (uint8_t i = 0; i < measure_runs; ++i)
+            {
+                const auto begin = time_us_32();
+                eq.apply(samples.begin(), samples.begin() + measure_frames * device_output_channels * eq_config.stride);
+                min_us = std::min(min_us, time_us_32() - begin);
+            }
+            return min_us;
+        };
+
+        const auto one_us = measure_us(1);
+        const auto all_us = measure_us(max_output_eq_sections);
+        const uint64_t cycles = uint64_t(all_us > one_us ? all_us - one_us : 0) * clock_get_hz(clk_sys) / 1000000;
+        return cycles / ((max_output_eq_sections - 1) * measure_frames * device_output_channels);
+    }
+
+    static void measure_output_eq_section_costs()
+    {
+        for (auto &cost : g_output_eq_section_costs)
+            cost.cycles_per_sample = measure_output_eq_section_cycles_per_sample(cost.bits);
+    }
+
+    // a resolution between the measured ones takes the next higher.
+    static uint32_t get_output_eq_section_cycles_per_sample(uint8_t bits)
+    {
+        for (const auto &cost : g_output_eq_section_costs)
+        {
+            if (bits <= cost.bits)
+                return cost.cycles_per_sample;
+        }
+        return g_output_eq_section_costs.back().cycles_per_sample;
+    }
+
+    static void update_output_equalizers()
+    {
+        processing::equalizer::config eq_config = {
+            .bits = g_output_resolution_bits,
+            .stride = bits_to_bytes(g_output_resolution_bits),
+            .channels = device_output_channels};
+        for (auto &eq : g_output_equalizers)
+            eq.setup(eq_config);
+    }
+
+    static bool is_output_device_running()
+    {
+        bool running = false;
+#if DAC_OUTPUT_ENABLE
+        running |= g_dac_out.is_running();
+#endif
+#if SPDIF_OUTPUT_ENABLE
+        running |= g_spdif_out.is_running();
+#endif
+        return running;
+    }
+
 
 
     static void start_output_process_job();
     static void stop_output_process_job();
+    static void begin_output_transition(bool keep_tail);
 
     void set_rx_format(uint32_t sampling_frequency, uint32_t bits)
     {
@@ -217,26 +506,48 @@ namespace streaming
 
         stop_output_process_job();
 
+        // the devices keep running through a change of resolution, only a new sampling frequency restarts them.
+        const bool keep_running = g_output_sampling_frequency == sampling_frequency && is_output_device_running();
+        begin_output_transition(keep_running);
+
+        if (!keep_running)
+        {
 #if SPDIF_OUTPUT_ENABLE
-        g_spdif_out.stop();
+            g_spdif_out.stop();
 #endif
 #if DAC_OUTPUT_ENABLE
-        g_dac_out.stop();
+            g_dac_out.stop();
 #endif
+        }
 
         g_output_sampling_frequency = sampling_frequency;
         g_output_resolution_bits = bits;
 
         g_rx_stream_buffer.resize(get_samples_duration_ms(device_buffer_duration, g_output_sampling_frequency, device_output_channels) * bits_to_bytes(g_output_resolution_bits));
-        g_rx_stream_buffer_write_addr = g_rx_stream_buffer.begin();
-        g_rx_stream_buffer_read_addr = g_rx_stream_buffer.begin();
+        g_rx_stream_buffer.set_timestamp_interval_us(rx_stream_timestamp_interval_us);
+
+        g_loopback_buffer.resize(g_rx_stream_buffer.size());
 
+        if (keep_running)
+        {
 #if SPDIF_OUTPUT_ENABLE
-        g_spdif_out.set_format(sampling_frequency, bits);
+            g_spdif_out.set_resolution(bits);
 #endif
 #if DAC_OUTPUT_ENABLE
-        g_dac_out.set_format(sampling_frequency, bits);
+            g_dac_out.set_resolution(bits);
+#endif
+        }
+        else
+        {
+#if SPDIF_OUTPUT_ENABLE
+            g_spdif_out.set_format(sampling_frequency, bits);
 #endif
+#if DAC_OUTPUT_ENABLE
+            g_dac_out.set_format(sampling_frequency, bits);
+#endif
+        }
+        update_output_crossfades();
+        update_output_equalizers();
         update_output_mixer();
 
         start_output_process_job();
@@ -254,31 +565,38 @@ namespace streaming
 
     void get_rx_buffer_size(uint32_t &left, uint32_t &max_size)
     {
-        left = g_rx_stream_buffer.distance(g_rx_stream_buffer_write_addr, g_rx_stream_buffer_read_addr);
+        left = g_rx_stream_buffer.used();
         max_size = g_rx_stream_buffer.size();
     }
 
     void push_rx_data(size_t (*fn)(uint8_t *, size_t), size_t data_size)
     {
-        auto write_addr = g_rx_stream_buffer_write_addr;
-        auto data_size_saved = data_size;
-
-        while (data_size)
+        // read straight into the ring. what does not fit under the fill limit stays in the endpoint fifo.
+        size_t written = 0;
+        for (const auto &span : g_rx_stream_buffer.writable_spans())
         {
-            size_t sz = std::min(data_size, (size_t)(g_rx_stream_buffer.end() - g_rx_stream_buffer_write_addr));
-            fn(g_rx_stream_buffer_write_addr, sz);
-
-            data_size -= sz;
-            g_rx_stream_buffer_write_addr += sz;
-            if (g_rx_stream_buffer_write_addr >= g_rx_stream_buffer.end())
-                g_rx_stream_buffer_write_addr = g_rx_stream_buffer.begin();
+            const auto n = std::min(span.size(), data_size - written);
+            if (n == 0)
+                break;
+
+            const auto filled = fn(span.begin(), n);
+            written += filled;
+            if (filled < n)
+                break;
         }
+        g_rx_stream_buffer.commit_write(written);
+        if (written < data_size)
+            g_rx_stream_buffer.record_overrun();
 
 #if USB_IF_CONTROL_ENABLE
-        g_debug_stats.received_bytes += g_rx_stream_buffer.distance(g_rx_stream_buffer_write_addr, write_addr);
+        g_debug_stats.received_bytes += written;
+#else
+        (void)written;
 #endif
 
-        g_job_mix_out.set_pending();
+        // while a block is being written, its completion makes the output job pending.
+        if (g_job_mix_out.get_remaining_dependencies() == 0)
+            g_job_mix_out.set_pending();
     }
 
 
@@ -286,14 +604,51 @@ namespace streaming
     static void start_mix_input_job();
     static void stop_mix_input_job();
 
+    static bool is_monitored_bus(const routing_plan &plan, uint8_t bus_index)
+    {
+        for (const auto &output : plan.output_sinks)
+        {
+            if (output.shared_sink < 0 && output.monitor_bus == bus_index)
+                return true;
+        }
+        return false;
+    }
+
+    static void reset_input_mixing_buses()
+    {
+        const auto &plan = g_routing_plan;
+        for (uint8_t bus_index = 0; bus_index < max_input_mixing_buses; ++bus_index)
+        {
+            auto &bus = g_input_mixing_buses[bus_index];
+            bus.buffer.resize(get_samples_duration_ms(input_mixing_buffer_duration, g_input_sampling_frequency, device_input_channels) * bits_to_bytes(g_input_resolution_bits));
+            bus.silent_bytes.store_release(0);
+
+            // the output job counts toward the free space of a bus only while it monitors it.
+            if (is_monitored_bus(plan, bus_index))
+                bus.buffer.attach_reader(INPUT_BUS_READER_OUTPUT, 0);
+            else
+                bus.buffer.detach_reader(INPUT_BUS_READER_OUTPUT);
+        }
+    }
+
     void set_tx_format(uint32_t sampling_frequency, uint32_t bits)
     {
+        // the stream opens. the USB IN cursor counts toward the bus 0 free space until it closes.
+        g_input_mixing_buses[0].buffer.attach_reader(INPUT_BUS_READER_USB_IN, 0);
+
         if (g_input_sampling_frequency == sampling_frequency && g_input_resolution_bits == bits)
         {
             return;
         }
         STREAM_LOG("set tx format %u %u\n", sampling_frequency, bits);
 
+        // the monitor buses restart, fade the outputs over to them.
+        const bool output_active = g_output_resolution_bits != 0;
+        if (output_active)
+        {
+            stop_output_process_job();
+            begin_output_transition(is_output_device_running());
+        }
         stop_mix_input_job();
 
 #if ADC_INPUT_ENABLE
@@ -306,9 +661,7 @@ namespace streaming
         g_input_sampling_frequency = sampling_frequency;
         g_input_resolution_bits = bits;
 
-        g_input_mixing_buffer.resize(get_samples_duration_ms(input_mixing_buffer_duration, g_input_sampling_frequency, device_input_channels) * bits_to_bytes(g_input_resolution_bits));
-        g_input_mixing_buffer_pop_tx_read_addr = g_input_mixing_buffer.begin();
-        g_input_mixing_buffer_output_read_addr = g_input_mixing_buffer.begin();
+        reset_input_mixing_buses();
 
         update_input_mixer();
         update_output_mixer();
@@ -327,23 +680,43 @@ namespace streaming
         g_spdif_in.start();
 #endif
         start_mix_input_job();
+        if (output_active)
+            start_output_process_job();
     }
 
     size_t pop_tx_data(size_t (*fn)(const uint8_t *, const uint8_t *))
     {
-        static std::array<uint8_t, CFG_TUD_AUDIO_FUNC_1_EP_IN_SW_BUF_SZ> tmp_buf;
-
         const size_t epinPacketBytes = support::get_epin_packet_bytes(g_input_sampling_frequency, g_input_resolution_bits);
 
-        auto buffer_write_addr = g_input_mixing_buffer_write_addr;
-        const size_t available_size = g_input_mixing_buffer.distance(buffer_write_addr, g_input_mixing_buffer_pop_tx_read_addr);
-        
+        auto &bus = g_input_mixing_buses[0];
+        if (bus.buffer.is_lapped(INPUT_BUS_READER_USB_IN))
+        {
+            STREAM_LOG("[pop_tx] lapped by the input job\n");
+            bus.buffer.resync(INPUT_BUS_READER_USB_IN, g_job_mix_in.buffer_size);
+        }
+
+        const size_t available_size = bus.buffer.lag(INPUT_BUS_READER_USB_IN);
+        bus.buffer.record_fill(available_size);
+        bus.buffer.record_underrun(available_size <= epinPacketBytes);
+
+        // the packet goes to the endpoint straight from the bus, in two pieces when it wraps.
+        // nothing is sent while exhausted, rather than repeating stale samples.
+        size_t sent_bytes = 0;
         if (available_size > epinPacketBytes)
         {
-            size_t copy_size = epinPacketBytes;
-            g_input_mixing_buffer_pop_tx_read_addr = g_input_mixing_buffer.copy_to(buffer_write_addr, g_input_mixing_buffer_pop_tx_read_addr, tmp_buf.begin(), copy_size);
+#if USB_IF_CONTROL_ENABLE
+            uint64_t written_us;
+            if (bus.buffer.get_timestamps().get_write_time(bus.buffer.get_read_counter(INPUT_BUS_READER_USB_IN), written_us))
+                g_debug_stats.transfar_max_latency_us = std::max<uint32_t>(g_debug_stats.transfar_max_latency_us, time_us_64() - written_us);
+#endif
+            for (const auto &span : bus.buffer.readable_spans(INPUT_BUS_READER_USB_IN, epinPacketBytes))
+            {
+                if (span.size())
+                    sent_bytes += fn(span.begin(), span.end());
+            }
+            bus.buffer.commit_read(INPUT_BUS_READER_USB_IN, sent_bytes);
 
-            dbg_assert(copy_size == epinPacketBytes);
+            dbg_assert(sent_bytes == epinPacketBytes);
         }
         else
         {
@@ -351,34 +724,554 @@ namespace streaming
         }
 
 #if USB_IF_CONTROL_ENABLE
-        g_debug_stats.transfar_bytes += epinPacketBytes;
+        g_debug_stats.transfar_bytes += sent_bytes;
 #endif
 
-        return fn(tmp_buf.begin(), tmp_buf.begin() + epinPacketBytes);
+        return sent_bytes;
     }
 
     void close_tx()
     {
+        g_input_mixing_buses[0].buffer.detach_reader(INPUT_BUS_READER_USB_IN);
+    }
+
+    static constexpr bool is_route_available(uint8_t source, uint8_t sink)
+    {
+        switch (source)
+        {
+        case ROUTE_SOURCE_LINE_IN:
+            if (!ADC_INPUT_ENABLE)
+                return false;
+            break;
+        case ROUTE_SOURCE_SPDIF_IN:
+            if (!SPDIF_INPUT_ENABLE)
+                return false;
+            break;
+        }
+
+        switch (sink)
+        {
+        case ROUTE_SINK_DAC:
+            if (!DAC_OUTPUT_ENABLE)
+                return false;
+            break;
+        case ROUTE_SINK_SPDIF_OUT:
+            if (!SPDIF_OUTPUT_ENABLE)
+                return false;
+            break;
+        }
+
+        // input sources reach the output sinks through the input mixing buses.
+        if (source != ROUTE_SOURCE_USB_OUT && sink != ROUTE_SINK_USB_IN)
+            return MIXING_INPUT_TO_OUTPUT_ENABLE;
+        return true;
+    }
+
+    static int16_t get_route_volume(uint8_t source, uint8_t sink)
+    {
+        return is_route_available(source, sink) ? g_route_volume_db[source][sink] : processing::mixer::min_volume_db;
+    }
+
+    static uint16_t get_route_gain(uint8_t source, uint8_t sink)
+    {
+        uint32_t trim = processing::mixer::unity_gain;
+        if (source == ROUTE_SOURCE_LINE_IN)
+            trim = g_input_mixer_adc_gain;
+        else if (source == ROUTE_SOURCE_SPDIF_IN)
+            trim = g_input_mixer_spdif_gain;
+
+        const uint32_t gain = processing::mixer::db_to_gain(get_route_volume(source, sink));
+        return std::min<uint32_t>((gain * trim + processing::mixer::unity_gain / 2) >> 15, 0xffff);
+    }
+
+    static routing_plan compile_routing()
+    {
+        routing_plan plan = {};
+
+        // buses are told apart by their crosspoint volumes, so source volumes never change the topology.
+        using bus_volumes = std::array<int16_t, ROUTE_SOURCE_NUM>;
+        std::array<bus_volumes, max_input_mixing_buses> buses;
+        std::array<uint8_t, max_input_mixing_buses> bus_sinks;
+        for (uint8_t source = 0; source < ROUTE_SOURCE_NUM; ++source)
+            buses[0][source] = get_route_volume(source, ROUTE_SINK_USB_IN);
+        bus_sinks[0] = ROUTE_SINK_USB_IN;
+        plan.input_bus_count = 1;
+
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            auto &output = plan.output_sinks[sink];
+            output.usb_out = get_route_volume(ROUTE_SOURCE_USB_OUT, sink) > processing::mixer::min_volume_db;
+            output.usb_out_gain = get_route_gain(ROUTE_SOURCE_USB_OUT, sink);
+            output.monitor_bus = -1;
+            output.shared_sink = -1;
+
+            // USB OUT is mixed directly, never through a bus.
+            bus_volumes volumes;
+            volumes[ROUTE_SOURCE_USB_OUT] = processing::mixer::min_volume_db;
+            bool has_input = false;
+            for (uint8_t source = ROUTE_SOURCE_LINE_IN; source < ROUTE_SOURCE_NUM; ++source)
+            {
+                volumes[source] = get_route_volume(source, sink);
+                has_input |= volumes[source] > processing::mixer::min_volume_db;
+            }
+
+            if (has_input)
+            {
+                uint8_t bus = 0;
+                while (bus < plan.input_bus_count && buses[bus] != volumes)
+                    ++bus;
+                if (bus == plan.input_bus_count)
+                {
+                    buses[bus] = volumes;
+                    bus_sinks[bus] = sink;
+                    ++plan.input_bus_count;
+                }
+                output.monitor_bus = bus;
+            }
+
+            for (uint8_t other = 0; other < sink; ++other)
+            {
+                const auto &other_output = plan.output_sinks[other];
+                if (other_output.shared_sink < 0 && other_output.usb_out == output.usb_out && other_output.usb_out_gain == output.usb_out_gain && other_output.monitor_bus == output.monitor_bus)
+                {
+                    output.shared_sink = other;
+                    break;
+                }
+            }
+        }
+
+        for (uint8_t bus = 0; bus < plan.input_bus_count; ++bus)
+        {
+            for (uint8_t source = 0; source < ROUTE_SOURCE_NUM; ++source)
+            {
+                if (buses[bus][source] <= processing::mixer::min_volume_db)
+                    continue;
+
+                auto &pass = plan.input_passes[plan.input_pass_count++];
+                pass.source = source;
+                pass.bus = bus;
+                pass.gain = get_route_gain(source, bus_sinks[bus]);
+            }
+        }
+        plan.loopback = buses[0][ROUTE_SOURCE_USB_OUT] > processing::mixer::min_volume_db;
+
+        return plan;
+    }
+
+    static bool is_same_routing_topology(const routing_plan &a, const routing_plan &b)
+    {
+        if (a.input_pass_count != b.input_pass_count || a.input_bus_count != b.input_bus_count || a.loopback != b.loopback)
+            return false;
+
+        for (uint8_t i = 0; i < a.input_pass_count; ++i)
+        {
+            if (a.input_passes[i].source != b.input_passes[i].source || a.input_passes[i].bus != b.input_passes[i].bus)
+                return false;
+        }
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            const auto &x = a.output_sinks[sink];
+            const auto &y = b.output_sinks[sink];
+            if (x.usb_out != y.usb_out || x.monitor_bus != y.monitor_bus)
+                return false;
+        }
+        return true;
+    }
+
+    static void stage_output_sharing(const routing_plan &plan)
+    {
+        critical_section_enter_blocking(&g_output_sharing_critical_section);
+        bool changed = false;
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            g_output_sharing_staging.shared_sinks[sink] = plan.output_sinks[sink].shared_sink;
+            changed |= plan.output_sinks[sink].shared_sink != g_routing_plan.output_sinks[sink].shared_sink;
+        }
+        g_output_sharing_staging.pending = changed;
+        critical_section_exit(&g_output_sharing_critical_section);
+    }
+
+    static void update_routing()
+    {
+        const auto plan = compile_routing();
+
+        if (is_same_routing_topology(plan, g_routing_plan))
+        {
+            // gain changes are picked up by the next pass, the sharing they cause by the next block.
+            for (uint8_t i = 0; i < plan.input_pass_count; ++i)
+                g_routing_plan.input_passes[i].gain = plan.input_passes[i].gain;
+            for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+                g_routing_plan.output_sinks[sink].usb_out_gain = plan.output_sinks[sink].usb_out_gain;
+            stage_output_sharing(plan);
+            return;
+        }
+
+        if (g_output_resolution_bits == 0 || g_input_resolution_bits == 0)
+        {
+            g_routing_plan = plan;
+            stage_output_sharing(plan);
+            return;
+        }
+
+        STREAM_LOG("routing changed. %u passes %u buses\n", plan.input_pass_count, plan.input_bus_count);
+
+        stop_output_process_job();
+        stop_mix_input_job();
+
+        begin_output_transition(is_output_device_running());
+        g_routing_plan = plan;
+        stage_output_sharing(plan);
+        reset_input_mixing_buses();
+        g_loopback_buffer.reset();
+
+        start_mix_input_job();
+        start_output_process_job();
+    }
+
+    void set_route_volume_db(uint8_t source, uint8_t sink, int16_t value)
+    {
+        if (source >= ROUTE_SOURCE_NUM || sink >= ROUTE_SINK_NUM)
+            return;
+
+        g_route_volume_db[source][sink] = std::max(value, processing::mixer::min_volume_db);
+        update_routing();
+    }
+
+    int16_t get_route_volume_db(uint8_t source, uint8_t sink)
+    {
+        if (source >= ROUTE_SOURCE_NUM || sink >= ROUTE_SINK_NUM)
+            return processing::mixer::min_volume_db;
+
+        return g_route_volume_db[source][sink];
+    }
+
+    static int16_t linear_volume_to_db(uint8_t value)
+    {
+        return processing::mixer::gain_to_db(value*processing::mixer::unity_gain/0xff);
+    }
+
+    static uint8_t db_to_linear_volume(int16_t volume_db)
+    {
+        return std::min<uint32_t>((processing::mixer::db_to_gain(volume_db)*0xff + processing::mixer::unity_gain/2)/processing::mixer::unity_gain, 0xff);
     }
 
     void set_spdif_in_volume(uint8_t value)
     {
-        g_input_mixer_spdif_volume = value;
+        set_spdif_in_volume_db(linear_volume_to_db(value));
     }
 
     void set_line_in_volume(uint8_t value)
     {
-        g_input_mixer_adc_volume = value;
+        set_line_in_volume_db(linear_volume_to_db(value));
     }
 
     uint8_t get_spdif_in_volume()
     {
-        return g_input_mixer_spdif_volume;
+        return db_to_linear_volume(g_input_mixer_spdif_volume_db);
     }
 
     uint8_t get_line_in_volume()
     {
-        return g_input_mixer_adc_volume;
+        return db_to_linear_volume(g_input_mixer_adc_volume_db);
+    }
+
+    void set_spdif_in_volume_db(int16_t value)
+    {
+        g_input_mixer_spdif_volume_db = value;
+        g_input_mixer_spdif_gain = processing::mixer::db_to_gain(value);
+        update_routing();
+    }
+
+    void set_line_in_volume_db(int16_t value)
+    {
+        g_input_mixer_adc_volume_db = value;
+        g_input_mixer_adc_gain = processing::mixer::db_to_gain(value);
+        update_routing();
+    }
+
+    int16_t get_spdif_in_volume_db()
+    {
+        return g_input_mixer_spdif_volume_db;
+    }
+
+    int16_t get_line_in_volume_db()
+    {
+        return g_input_mixer_adc_volume_db;
+    }
+
+    void set_level_meter_enabled(bool enabled)
+    {
+        if (enabled && !g_level_meter_enabled)
+        {
+            for (auto &meter : g_level_meters)
+                processing::mixer::reset_meter(meter);
+        }
+        g_level_meter_enabled = enabled;
+    }
+
+    bool is_level_meter_enabled()
+    {
+        return g_level_meter_enabled;
+    }
+
+    level_meter_value get_level_meter(uint8_t source, uint8_t channel)
+    {
+        if (source >= LEVEL_METER_SOURCE_NUM || channel >= processing::mixer::max_meter_channels)
+            return {};
+
+        return g_level_meters[source].channels[channel].published;
+    }
+
+    static processing::mixer::meter *get_active_level_meter(level_meter_source source)
+    {
+        return g_level_meter_enabled ? &g_level_meters[source] : nullptr;
+    }
+
+    static void reset_limiters()
+    {
+        for (auto &bus : g_input_mixing_buses)
+            processing::mixer::reset_limiter(bus.limiter);
+        for (auto &limiter : g_output_limiters)
+            processing::mixer::reset_limiter(limiter);
+    }
+
+    void set_limiter_enabled(bool enabled)
+    {
+        if (enabled && !g_limiter_enabled)
+            reset_limiters();
+        g_limiter_enabled = enabled;
+    }
+
+    bool is_limiter_enabled()
+    {
+        return g_limiter_enabled;
+    }
+
+    void set_transition_frames(uint16_t frames)
+    {
+        g_transition_frames = std::min(frames, max_transition_frames);
+    }
+
+    uint16_t get_transition_frames()
+    {
+        return g_transition_frames;
+    }
+
+    void set_output_eq(const eq_section *sections, uint8_t count)
+    {
+        count = std::min(count, max_output_eq_sections);
+
+        critical_section_enter_blocking(&g_output_eq_critical_section);
+        for (uint8_t i = 0; i < count; ++i)
+            g_output_eq_staging.sections[i] = {sections[i].b0, sections[i].b1, sections[i].b2, sections[i].a1, sections[i].a2};
+        g_output_eq_staging.count = count;
+        g_output_eq_staging.pending = true;
+        critical_section_exit(&g_output_eq_critical_section);
+    }
+
+    uint8_t get_output_eq_max_sections()
+    {
+        return g_output_eq_max_sections;
+    }
+
+    uint8_t get_output_eq(eq_section *sections, uint8_t max_count)
+    {
+        critical_section_enter_blocking(&g_output_eq_critical_section);
+        const uint8_t count = std::min(g_output_eq_staging.count, max_count);
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            const auto &section = g_output_eq_staging.sections[i];
+            sections[i] = {section.b0, section.b1, section.b2, section.a1, section.a2};
+        }
+        critical_section_exit(&g_output_eq_critical_section);
+        return count;
+    }
+
+    void set_line_in_dynamics_enabled(bool enabled)
+    {
+        critical_section_enter_blocking(&g_line_in_dynamics_critical_section);
+        g_line_in_dynamics_staging.reset |= enabled && !g_line_in_dynamics_enabled;
+        g_line_in_dynamics_staging.pending = true;
+        g_line_in_dynamics_enabled = enabled;
+        critical_section_exit(&g_line_in_dynamics_critical_section);
+    }
+
+    bool is_line_in_dynamics_enabled()
+    {
+        return g_line_in_dynamics_enabled;
+    }
+
+    void set_line_in_dynamics(const dynamics_parameters &params)
+    {
+        critical_section_enter_blocking(&g_line_in_dynamics_critical_section);
+        g_line_in_dynamics_staging.parameters = {
+            .threshold_db = params.threshold_db,
+            .makeup_db = params.makeup_db,
+            .gate_db = params.gate_db,
+            .attack_ms = params.attack_ms,
+            .release_ms = params.release_ms,
+            .ratio = params.ratio};
+        g_line_in_dynamics_staging.pending = true;
+        critical_section_exit(&g_line_in_dynamics_critical_section);
+    }
+
+    dynamics_parameters get_line_in_dynamics()
+    {
+        critical_section_enter_blocking(&g_line_in_dynamics_critical_section);
+        const auto &params = g_line_in_dynamics_staging.parameters;
+        const dynamics_parameters result = {
+            .threshold_db = params.threshold_db,
+            .makeup_db = params.makeup_db,
+            .gate_db = params.gate_db,
+            .attack_ms = params.attack_ms,
+            .release_ms = params.release_ms,
+            .ratio = params.ratio};
+        critical_section_exit(&g_line_in_dynamics_critical_section);
+        return result;
+    }
+
+    int16_t get_line_in_dynamics_gain_db()
+    {
+        return g_line_in_dynamics_enabled ? g_line_in_dynamics.get_gain_db() : 0;
+    }
+
+    static void job_spectrum(job_queue::work *)
+    {
+        JOB_TRACE_LOG("job_spectrum\n");
+
+        if (g_spectrum.get_points() != g_spectrum_points)
+            g_spectrum.setup(g_spectrum_points);
+
+        switch (g_spectrum.get_state())
+        {
+        case processing::spectrum::STATE_IDLE:
+            g_spectrum.arm();
+            g_job_spectrum.set_pending_delay_us(spectrum_slice_interval_us);
+            break;
+        case processing::spectrum::STATE_CAPTURING:
+            g_job_spectrum.set_pending_delay_us(spectrum_slice_interval_us);
+            break;
+        default:
+        {
+            PROFILE_MEASURE_BEGIN(PROF_SPECTRUM);
+            const bool published = g_spectrum.process(spectrum_slice_butterflies);
+            PROFILE_MEASURE_END();
+            g_job_spectrum.set_pending_delay_us(published ? spectrum_refresh_interval_us : spectrum_slice_interval_us);
+            break;
+        }
+        }
+    }
+
+    void set_spectrum_enabled(bool enabled)
+    {
+        if (enabled == g_spectrum_enabled)
+            return;
+
+        if (enabled)
+        {
+            g_spectrum.setup(g_spectrum_points);
+            g_job_spectrum.set_callback(job_spectrum);
+            g_job_spectrum.activate();
+            g_job_spectrum.set_pending();
+        }
+        else
+        {
+            g_job_spectrum.deactivate();
+            g_job_spectrum.wait_done();
+            g_spectrum.setup(g_spectrum_points);
+        }
+        g_spectrum_enabled = enabled;
+    }
+
+    bool is_spectrum_enabled()
+    {
+        return g_spectrum_enabled;
+    }
+
+    void set_spectrum_source(uint8_t source)
+    {
+        if (source < SPECTRUM_SOURCE_NUM)
+            g_spectrum_source = source;
+    }
+
+    uint8_t get_spectrum_source()
+    {
+        return g_spectrum_source;
+    }
+
+    void set_spectrum_points(uint16_t points)
+    {
+        g_spectrum_points = points <= 256 ? 256 : processing::spectrum::max_points;
+    }
+
+    uint16_t get_spectrum_points()
+    {
+        return g_spectrum_points;
+    }
+
+    uint16_t get_spectrum(int16_t *bins, uint16_t max_count)
+    {
+        return g_spectrum_enabled ? g_spectrum.get_bins(bins, max_count) : 0;
+    }
+
+    static void take_line_in_dynamics()
+    {
+        critical_section_enter_blocking(&g_line_in_dynamics_critical_section);
+        g_line_in_dynamics.set_parameters(g_line_in_dynamics_staging.parameters);
+        if (g_line_in_dynamics_staging.reset)
+            g_line_in_dynamics.reset();
+        g_line_in_dynamics_staging.reset = false;
+        g_line_in_dynamics_staging.pending = false;
+        critical_section_exit(&g_line_in_dynamics_critical_section);
+    }
+
+    static uint8_t get_output_eq_section_limit(const routing_plan &plan)
+    {
+        uint32_t sinks = 0;
+        for (const auto &output : plan.output_sinks)
+            sinks += output.shared_sink < 0;
+
+        const uint64_t section_cycles_per_second = uint64_t(get_output_eq_section_cycles_per_sample(g_output_resolution_bits))
+            * device_output_channels * g_output_sampling_frequency * sinks;
+        if (section_cycles_per_second == 0)
+            return max_output_eq_sections;
+
+        const uint64_t budget_cycles_per_second = uint64_t(clock_get_hz(clk_sys)) * output_eq_budget_percent / 100;
+        return std::min<uint64_t>(budget_cycles_per_second / section_cycles_per_second, max_output_eq_sections);
+    }
+
+    // also taken at the start of the output job, since the limit follows the format and the routing.
+    static void take_output_eq()
+    {
+        g_output_eq_max_sections = get_output_eq_section_limit(g_routing_plan);
+
+        critical_section_enter_blocking(&g_output_eq_critical_section);
+        const auto count = std::min(g_output_eq_staging.count, g_output_eq_max_sections);
+        if (count < g_output_eq_staging.count)
+            STREAM_LOG("output eq limited to %u of %u sections\n", count, g_output_eq_staging.count);
+        for (auto &eq : g_output_equalizers)
+            eq.set_sections(g_output_eq_staging.sections.data(), count);
+        g_output_eq_staging.pending = false;
+        critical_section_exit(&g_output_eq_critical_section);
+    }
+
+    // the eq limit counts the sinks mixed on their own, so it is taken again.
+    static void take_output_sharing()
+    {
+        critical_section_enter_blocking(&g_output_sharing_critical_section);
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            auto &output = g_routing_plan.output_sinks[sink];
+            const auto shared_sink = g_output_sharing_staging.shared_sinks[sink];
+            // a sink mixed on its own again starts its equalizer from a cleared state.
+            if (output.shared_sink >= 0 && shared_sink < 0)
+                g_output_equalizers[sink].reset();
+            output.shared_sink = shared_sink;
+        }
+        g_output_sharing_staging.pending = false;
+        critical_section_exit(&g_output_sharing_critical_section);
+
+        take_output_eq();
     }
 
 
@@ -401,20 +1294,28 @@ namespace streaming
 #endif
         g_job_mix_out.set_callback(job_mix_output_init);
         g_job_mix_out.activate();
+        // no block is being written yet, and a stop may have left the count of one.
+        g_job_mix_out.set_dependencies(0);
         g_job_mix_out.set_pending();
     }
     static void stop_output_process_job()
     {
         STREAM_LOG("stop output process job\n");
 
+        // deactivate all before waiting, so no job is made pending again and the runs in progress end together.
         g_job_mix_out.deactivate();
-        g_job_mix_out.wait_done();
 #if DAC_OUTPUT_ENABLE
         g_job_mix_out_dac.deactivate();
-        g_job_mix_out_dac.wait_done();
 #endif
 #if SPDIF_OUTPUT_ENABLE
         g_job_mix_out_spdif.deactivate();
+#endif
+
+        g_job_mix_out.wait_done();
+#if DAC_OUTPUT_ENABLE
+        g_job_mix_out_dac.wait_done();
+#endif
+#if SPDIF_OUTPUT_ENABLE
         g_job_mix_out_spdif.wait_done();
 #endif
     }
@@ -425,114 +1326,272 @@ namespace streaming
 
         g_job_mix_out.sample_bytes = bits_to_bytes(g_output_resolution_bits);
         g_job_mix_out.buffer_size = get_samples_duration_ms(output_mixing_processing_buffer_duration_per_cycle, g_output_sampling_frequency, device_output_channels) * g_job_mix_out.sample_bytes;
+        if (g_output_sharing_staging.pending)
+            take_output_sharing();
+        take_output_eq();
         g_job_mix_out.set_callback(job_mix_output_process);
         g_job_mix_out.set_pending();
     }
 
+    static uint8_t get_output_sink_buffer_index(const routing_plan &plan, uint8_t sink)
+    {
+        const auto shared_sink = plan.output_sinks[sink].shared_sink;
+        return shared_sink >= 0 ? shared_sink : sink;
+    }
+
+    // called while the output job is stopped and before the format or the routing is changed.
+    static void begin_output_transition(bool keep_tail)
+    {
+        const uint8_t sample_bytes = g_job_mix_out.sample_bytes;
+        const size_t frame_bytes = sample_bytes * device_output_channels;
+        const size_t block_frames = frame_bytes ? g_job_mix_out.buffer_size / frame_bytes : 0;
+
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            auto &transition = g_output_transitions[sink];
+            const uint32_t transition_frames = keep_tail ? std::min<uint32_t>(g_transition_frames, block_frames) : g_transition_frames;
+            transition.tail_frames = keep_tail ? transition_frames : 0;
+
+            const auto &buf = g_output_mix_bufs[get_output_sink_buffer_index(g_routing_plan, sink)];
+            for (uint32_t i = 0; i < transition.tail_frames; ++i)
+            {
+                const uint8_t *frame = buf.begin() + (block_frames - 1 - i) * frame_bytes;
+                for (uint8_t ch = 0; ch < device_output_channels; ++ch)
+                {
+                    // left aligned, so the tail is independent of the next format.
+                    uint32_t value = 0;
+                    for (uint8_t b = 0; b < sample_bytes; ++b)
+                        value |= (uint32_t)frame[ch * sample_bytes + b] << (8 * (sizeof(uint32_t) - sample_bytes + b));
+                    transition.tail[i * device_output_channels + ch] = (int32_t)value;
+                }
+            }
+
+            transition.crossfade.start(transition_frames);
+        }
+    }
+
+#if MIXING_INPUT_TO_OUTPUT_ENABLE
+    // the input job keeps writing while the output job skips blocks, so the monitor readers are checked on every run.
+    // a reader left behind for 2^32 bytes would see a small lag again and never count as lapped.
+    static void resync_lapped_monitor_readers()
+    {
+        const auto &plan = g_routing_plan;
+        for (uint8_t bus_index = 0; bus_index < plan.input_bus_count; ++bus_index)
+        {
+            auto &bus = g_input_mixing_buses[bus_index];
+            if (is_monitored_bus(plan, bus_index) && bus.buffer.is_lapped(INPUT_BUS_READER_OUTPUT))
+            {
+                STREAM_LOG("input bus %u lapped the output.\n", bus_index);
+                bus.buffer.resync(INPUT_BUS_READER_OUTPUT, g_job_mix_in.buffer_size);
+            }
+        }
+    }
+#endif
+
     static void job_mix_output_process(job_queue::work *)
     {
         JOB_TRACE_LOG("job_mix_output_process\n");
 
-        static std::array<uint8_t, max_output_samples_1ms * output_mixing_processing_buffer_duration_per_cycle * sizeof(uint32_t)> data_tmp_buf;
-        static std::array<uint8_t, max_output_samples_1ms * output_mixing_processing_buffer_duration_per_cycle * sizeof(uint32_t)> mix_tmp_buf;
+#if MIXING_INPUT_TO_OUTPUT_ENABLE
+        resync_lapped_monitor_readers();
+#endif
+
+        static output_process_buffer monitor_tmp_buf;
+        auto &mix_tmp_bufs = g_output_mix_bufs;
 
         const uint8_t output_sample_bytes = g_job_mix_out.sample_bytes;
         const size_t buffer_size = g_job_mix_out.buffer_size;
 
-        bool is_idle_write_job = true;
-#if DAC_OUTPUT_ENABLE
-        is_idle_write_job &= g_job_mix_out_dac.is_idle();
-#endif
-#if SPDIF_OUTPUT_ENABLE
-        is_idle_write_job &= g_job_mix_out_spdif.is_idle();
-#endif
-
-        if (!is_idle_write_job)
-        {
-            g_job_mix_out.set_pending_delay_us(100);
+        // made pending by usb data while the last block was still being written. its completion runs this again.
+        if (g_job_mix_out.get_remaining_dependencies() != 0)
             return;
-        }
 
-        if (g_rx_stream_buffer.distance(g_rx_stream_buffer_write_addr, g_rx_stream_buffer_read_addr) < buffer_size)
+        const auto rx_used_bytes = g_rx_stream_buffer.used();
+        g_rx_stream_buffer.record_underrun(rx_used_bytes < buffer_size);
+        if (rx_used_bytes < buffer_size)
         {
             g_job_mix_out.set_pending_delay_us(200);
             return;
         }
 
 #if USB_IF_CONTROL_ENABLE
-        g_debug_stats.outmix.src_left = g_rx_stream_buffer.distance(g_rx_stream_buffer_write_addr, g_rx_stream_buffer_read_addr);
+        g_debug_stats.outmix.src_left = rx_used_bytes;
 #endif
+        g_rx_stream_buffer.record_fill(rx_used_bytes);
+
+        // the sharing changes only between blocks.
+        if (g_output_sharing_staging.pending)
+            take_output_sharing();
 
         PROFILE_MEASURE_BEGIN(PROF_MIXOUT_USBDATA);
         
-        const auto rx_stream_buffer_write_addr = g_rx_stream_buffer_write_addr;
-        auto read_addr = g_rx_stream_buffer_read_addr;
+        const auto &plan = g_routing_plan;
+        const auto rx_block = g_rx_stream_buffer.readable_span(buffer_size);
+        const size_t fetch_bytes = rx_block.size();
+        dbg_assert(fetch_bytes == buffer_size);
 
-        size_t fetch_bytes = buffer_size;
-        g_rx_stream_buffer_read_addr =
-            g_rx_stream_buffer.copy_to(rx_stream_buffer_write_addr, g_rx_stream_buffer_read_addr, data_tmp_buf.begin(), fetch_bytes);
+        if (plan.loopback)
+        {
+            // drop the block rather than overrunning the reader.
+            if (fetch_bytes <= g_loopback_buffer.available())
+                g_loopback_buffer.write(rx_block.begin(), fetch_bytes);
+            else
+                g_loopback_buffer.record_overrun();
+        }
 
-        g_output_mixer.apply(
-            g_output_mixer_rx_volume,
-            data_tmp_buf.begin(), data_tmp_buf.begin() + fetch_bytes,
-            mix_tmp_buf.begin(), mix_tmp_buf.begin() + fetch_bytes, true);
+        std::array<bool, output_sink_num> sink_mixed = {};
+        auto usb_out_meter = get_active_level_meter(LEVEL_METER_USB_OUT);
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            const auto &output = plan.output_sinks[sink];
+            if (output.shared_sink >= 0 || !output.usb_out)
+                continue;
 
+            g_output_mixer.apply(
+                output.usb_out_gain,
+                rx_block.begin(), rx_block.end(),
+                mix_tmp_bufs[sink].begin(), mix_tmp_bufs[sink].begin() + fetch_bytes, true,
+                usb_out_meter);
+            usb_out_meter = nullptr;
+            sink_mixed[sink] = true;
+        }
+
+        if (g_level_meter_enabled)
+            processing::mixer::update_meter(g_level_meters[LEVEL_METER_USB_OUT], output_level_meter_config);
+
+        g_rx_stream_buffer.commit_read(fetch_bytes);
         PROFILE_MEASURE_END();
 
 #if MIXING_INPUT_TO_OUTPUT_ENABLE
-        auto input_mixing_buffer_write_addr = g_input_mixing_buffer_write_addr;
-        const auto input_available_bytes =
-            g_input_mixing_buffer.distance(input_mixing_buffer_write_addr, g_input_mixing_buffer_output_read_addr);
-        if (g_output_input_converter.get_requirement_src_bytes(fetch_bytes) <= input_available_bytes)
-        {
-            PROFILE_MEASURE_BEGIN(PROF_MIXOUT_LINEIN_FETCH);
-            auto dst = data_tmp_buf.begin();
-            g_input_mixing_buffer_output_read_addr = 
-                g_input_mixing_buffer.apply_linear(input_mixing_buffer_write_addr, g_input_mixing_buffer_output_read_addr, 
-                [&](const uint8_t *begin, const uint8_t *end)
+        for (uint8_t bus_index = 0; bus_index < plan.input_bus_count; ++bus_index)
+        {
+            if (!is_monitored_bus(plan, bus_index))
+                continue;
+
+            auto &bus = g_input_mixing_buses[bus_index];
+
+            // silent_bytes holds only for the write position it was stored after, discard it if the writer moved meanwhile.
+            const auto input_available_bytes = bus.buffer.lag(INPUT_BUS_READER_OUTPUT);
+            const auto bus_silent_bytes = bus.silent_bytes.load_acquire();
+            const auto input_silent_bytes = bus.buffer.lag(INPUT_BUS_READER_OUTPUT) == input_available_bytes ? bus_silent_bytes : 0;
+            if (input_silent_bytes != 0 && input_available_bytes <= input_silent_bytes)
+            {
+                // nothing but silence to read. skip conversion and mixing, the sinks are cleared below if nothing else is mixed.
+                // an empty bus without silence is exhausted and goes on below.
+                const auto skip_bytes = bus.output_converter.skip(input_available_bytes, fetch_bytes);
+                bus.buffer.commit_read(INPUT_BUS_READER_OUTPUT, std::min(skip_bytes, input_available_bytes));
+            }
+            else if (bus.output_converter.get_requirement_src_bytes(fetch_bytes) <= input_available_bytes)
+            {
+                PROFILE_MEASURE_BEGIN(PROF_MIXOUT_LINEIN_FETCH);
+                auto dst = monitor_tmp_buf.begin();
+                bus.buffer.apply_linear(INPUT_BUS_READER_OUTPUT,
+                    [&](const uint8_t *begin, const uint8_t *end)
+                    {
+                        auto result = bus.output_converter.apply(begin, end, dst, monitor_tmp_buf.begin() + fetch_bytes);
+                        dst += result.dst_advanced_bytes;
+                        return result.src_advanced_bytes;
+                    });
+                PROFILE_MEASURE_END();
+
+                PROFILE_MEASURE_BEGIN(PROF_MIXOUT_LINEIN_MIX);
+                for (uint8_t sink = 0; sink < output_sink_num; ++sink)
                 {
-                    auto result = g_output_input_converter.apply(begin, end, dst, data_tmp_buf.begin() + fetch_bytes);
-                    dst += result.dst_advanced_bytes;
-                    return result.src_advanced_bytes;
-                });
-            PROFILE_MEASURE_END();
+                    const auto &output = plan.output_sinks[sink];
+                    if (output.shared_sink >= 0 || output.monitor_bus != bus_index)
+                        continue;
+
+                    // the crosspoint gains are applied when the bus is mixed.
+                    g_output_mixer.apply(
+                        processing::mixer::unity_gain,
+                        monitor_tmp_buf.begin(), monitor_tmp_buf.begin() + fetch_bytes,
+                        mix_tmp_bufs[sink].begin(), mix_tmp_bufs[sink].begin() + fetch_bytes, !sink_mixed[sink],
+                        nullptr, g_limiter_enabled ? &g_output_limiters[sink] : nullptr);
+                    sink_mixed[sink] = true;
+
+                    if (g_limiter_enabled)
+                        processing::mixer::update_limiter(g_output_limiters[sink], output_limiter_config);
+                }
+                PROFILE_MEASURE_END();
+            }
+            else
+            {
+                STREAM_LOG("input stream exhausted.\n");
+            }
 
-            PROFILE_MEASURE_BEGIN(PROF_MIXOUT_LINEIN_MIX);
-            g_output_mixer.apply(
-                g_output_mixer_mixed_input_volume,
-                data_tmp_buf.begin(), data_tmp_buf.begin() + fetch_bytes,
-                mix_tmp_buf.begin(), mix_tmp_buf.begin() + fetch_bytes, false);
-            PROFILE_MEASURE_END();
-        }
-        else
-        {
-            STREAM_LOG("input stream exhausted.\n");
+#if USB_IF_CONTROL_ENABLE
+            if (bus_index == 0)
+                g_debug_stats.outmix.input_left = bus.buffer.lag(INPUT_BUS_READER_OUTPUT);
+#endif
         }
 
 #if USB_IF_CONTROL_ENABLE
-        g_debug_stats.outmix.input_left =
-            g_input_mixing_buffer.distance(input_mixing_buffer_write_addr, g_input_mixing_buffer_output_read_addr); 
         g_debug_stats.outmix.processed_bytes += fetch_bytes;
 #endif
 #endif
 
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            if (plan.output_sinks[sink].shared_sink < 0 && !sink_mixed[sink])
+                std::fill(mix_tmp_bufs[sink].begin(), mix_tmp_bufs[sink].begin() + fetch_bytes, 0);
+        }
+
+        // swap the coefficients only between blocks.
+        if (g_output_eq_staging.pending)
+            take_output_eq();
+
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            auto &eq = g_output_equalizers[sink];
+            if (plan.output_sinks[sink].shared_sink >= 0 || eq.get_section_count() == 0)
+                continue;
+
+            PROFILE_MEASURE_BEGIN(PROF_MIXOUT_EQ);
+            eq.apply(mix_tmp_bufs[sink].begin(), mix_tmp_bufs[sink].begin() + fetch_bytes);
+            PROFILE_MEASURE_END();
+        }
+
+        for (uint8_t sink = 0; sink < output_sink_num; ++sink)
+        {
+            auto &transition = g_output_transitions[sink];
+            if (plan.output_sinks[sink].shared_sink >= 0 || !transition.crossfade.is_active())
+                continue;
+
+            PROFILE_MEASURE_BEGIN(PROF_MIXOUT_CROSSFADE);
+            transition.crossfade.apply(
+                transition.tail.data(), transition.tail_frames,
+                mix_tmp_bufs[sink].begin(), mix_tmp_bufs[sink].begin() + fetch_bytes);
+            PROFILE_MEASURE_END();
+        }
+
+        if (g_spectrum_source == SPECTRUM_SOURCE_DAC)
+        {
+            const auto &spectrum_buf = mix_tmp_bufs[get_output_sink_buffer_index(plan, ROUTE_SINK_DAC)];
+            g_spectrum.capture(spectrum_buf.begin(), spectrum_buf.begin() + fetch_bytes, g_output_resolution_bits, device_output_channels);
+        }
+
         const auto fetch_samples = fetch_bytes / output_sample_bytes;
+        g_job_mix_out.set_dependencies(output_write_job_num);
 #if DAC_OUTPUT_ENABLE
+        auto &dac_buf = mix_tmp_bufs[get_output_sink_buffer_index(plan, ROUTE_SINK_DAC)];
         g_job_mix_out_dac.require_samples = fetch_samples;
-        g_job_mix_out_dac.data_begin = mix_tmp_buf.begin();
-        g_job_mix_out_dac.data_end = mix_tmp_buf.begin() + fetch_bytes;
+        g_job_mix_out_dac.data_begin = dac_buf.begin();
+        g_job_mix_out_dac.data_end = dac_buf.begin() + fetch_bytes;
         g_job_mix_out_dac.set_pending();
 #endif
 #if SPDIF_OUTPUT_ENABLE
+        auto &spdif_buf = mix_tmp_bufs[get_output_sink_buffer_index(plan, ROUTE_SINK_SPDIF_OUT)];
         g_job_mix_out_spdif.require_samples = fetch_samples;
-        g_job_mix_out_spdif.data_begin = mix_tmp_buf.begin();
-        g_job_mix_out_spdif.data_end = mix_tmp_buf.begin() + fetch_bytes;
+        g_job_mix_out_spdif.data_begin = spdif_buf.begin();
+        g_job_mix_out_spdif.data_end = spdif_buf.begin() + fetch_bytes;
         g_job_mix_out_spdif.set_pending();
 #endif
         if (g_output_device_charge_count)
             --g_output_device_charge_count;
 
-        g_job_mix_out.set_pending_delay_us(100);
+        // the next block is mixed as soon as the write jobs are done with this one, or usb data arrives.
+        if (output_write_job_num == 0)
+            g_job_mix_out.set_pending_delay_us(100);
     }
 
 #if DAC_OUTPUT_ENABLE
@@ -610,28 +1669,33 @@ namespace streaming
         STREAM_LOG("stop mixing task\n");
 
         g_job_mix_in.deactivate();
-        g_job_mix_in.wait_done();
-
 #if ADC_INPUT_ENABLE
         g_job_mix_in_adc.deactivate();
-        g_job_mix_in_adc.wait_done();
 #endif
 #if SPDIF_INPUT_ENABLE  
         g_job_mix_in_spdif.deactivate();
+#endif
+
+        g_job_mix_in.wait_done();
+#if ADC_INPUT_ENABLE
+        g_job_mix_in_adc.wait_done();
+#endif
+#if SPDIF_INPUT_ENABLE  
         g_job_mix_in_spdif.wait_done();
 #endif
     }
 
-    static size_t mix_input_mixing_out(uint8_t volume, const uint8_t *src_begin, const uint8_t *src_end, bool overwrite, const char *label)
+    static size_t mix_input_mixing_out(input_mixing_bus &bus, uint16_t gain, const uint8_t *src_begin, const uint8_t *src_end, bool overwrite, processing::mixer::meter *meter)
     {
-        auto dst = g_input_mixing_buffer_write_addr;
+        auto dst = bus.buffer.get_write_addr();
 
         size_t src_bytes = 0;
         size_t dst_bytes = 0;
         while (src_bytes < (src_end - src_begin))
         {
-            auto result = g_input_mixer.apply(volume, src_begin + src_bytes, src_end, dst, g_input_mixing_buffer.end(), overwrite);
-            dst = g_input_mixing_buffer.advance(dst, result.dst_advanced_bytes);
+            auto result = g_input_mixer.apply(gain, src_begin + src_bytes, src_end, dst, bus.buffer.end(), overwrite, meter,
+                g_limiter_enabled ? &bus.limiter : nullptr);
+            dst = bus.buffer.advance(dst, result.dst_advanced_bytes);
             dst_bytes += result.dst_advanced_bytes;
             src_bytes += result.src_advanced_bytes;
         }
@@ -639,11 +1703,55 @@ namespace streaming
         return dst_bytes;
     };
 
+    static void clear_input_mixing_out(input_mixing_bus &bus, size_t size)
+    {
+        auto dst = bus.buffer.get_write_addr();
+        while (size)
+        {
+            const auto n = std::min<size_t>(bus.buffer.end() - dst, size);
+            std::fill(dst, dst + n, 0);
+            dst = bus.buffer.advance(dst, n);
+            size -= n;
+        }
+    }
+
+    static void capture_spectrum_input(const input_mixing_bus &bus, const uint8_t *src, size_t size)
+    {
+        while (size)
+        {
+            const auto n = std::min<size_t>(bus.buffer.end() - src, size);
+            g_spectrum.capture(src, src + n, g_input_resolution_bits, device_input_channels);
+            src = bus.buffer.advance(src, n);
+            size -= n;
+        }
+    }
+
+    static size_t fetch_loopback(uint8_t *dst_begin, uint8_t *dst_end)
+    {
+        const auto available_bytes = g_loopback_buffer.used();
+        const bool starving = g_loopback_converter.get_requirement_src_bytes(dst_end - dst_begin) > available_bytes;
+        g_loopback_buffer.record_fill(available_bytes);
+        g_loopback_buffer.record_underrun(starving);
+        if (starving)
+            return 0;
+
+        auto dst = dst_begin;
+        g_loopback_buffer.apply_linear(
+            [&](const uint8_t *begin, const uint8_t *end)
+            {
+                auto result = g_loopback_converter.apply(begin, end, dst, dst_end);
+                dst += result.dst_advanced_bytes;
+                return result.src_advanced_bytes;
+            });
+        return dst - dst_begin;
+    }
+
     static void job_mix_input_init(job_queue::work*)
     {
         JOB_TRACE_LOG("job_mix_input_init\n");
 
-        g_input_mixing_buffer_write_addr = g_input_mixing_buffer.begin();
+        for (auto &bus : g_input_mixing_buses)
+            bus.silent_bytes.store_release(0);
 
         g_job_mix_in.require_samples = get_samples_duration_ms(input_mixing_processing_buffer_duration_per_cycle, g_input_sampling_frequency, device_input_channels);
         g_job_mix_in.buffer_size = g_job_mix_in.require_samples * bits_to_bytes(g_input_resolution_bits);
@@ -670,50 +1778,124 @@ namespace streaming
     {
         JOB_TRACE_LOG("job_mix_input_fetch\n");
 
+        // the read jobs wake this job as they complete. with a source short of data it mixes what there is at the timeout.
         if(time_us_64() < g_job_mix_in.timeout)
         {
             bool all_done = true;
 #if ADC_INPUT_ENABLE
-            if(g_job_mix_in_adc.result_size == 0 && g_job_mix_in_adc.is_idle())
-                g_job_mix_in_adc.set_pending();
             all_done &= g_job_mix_in_adc.result_size > 0 && g_job_mix_in_adc.is_idle();
 #endif
 #if SPDIF_INPUT_ENABLE
-            if(g_job_mix_in_spdif.result_size == 0 && g_job_mix_in_spdif.is_idle())
-                g_job_mix_in_spdif.set_pending();
             all_done &= g_job_mix_in_spdif.result_size > 0 && g_job_mix_in_spdif.is_idle();
 #endif
             if(!all_done)
             {
-                g_job_mix_in.set_pending_delay_us(200);
+                g_job_mix_in.set_pending_at(g_job_mix_in.timeout);
                 return;
             }
         }
         
         g_job_mix_in.timeout = g_job_mix_in.timeout + input_mixing_processing_buffer_duration_per_cycle*1000;
 
-        bool overwrite = true;
-#if ADC_INPUT_ENABLE
-        PROFILE_MEASURE_BEGIN(PROF_MIXIN_ADC_MIX);
-        if(g_job_mix_in_adc.result_size > 0)
+        const auto &plan = g_routing_plan;
+
+        size_t loopback_size = 0;
+        if(plan.loopback)
         {
-            mix_input_mixing_out(g_input_mixer_adc_volume, g_job_mix_in_adc.data_begin, g_job_mix_in_adc.data_end, overwrite, "adc");
-            overwrite = false;
+            PROFILE_MEASURE_BEGIN(PROF_MIXIN_LOOPBACK_FETCH);
+            loopback_size = fetch_loopback(g_loopback_fetch_buffer.begin(), g_loopback_fetch_buffer.begin() + g_job_mix_in.buffer_size);
+            PROFILE_MEASURE_END();
         }
-        PROFILE_MEASURE_END();
+
+        PROFILE_MEASURE_BEGIN(PROF_MIXIN_MIX);
+        std::array<bool, max_input_mixing_buses> bus_mixed = {};
+        std::array<bool, ROUTE_SOURCE_NUM> source_metered = {};
+        for(uint8_t i = 0; i < plan.input_pass_count; ++i)
+        {
+            const auto &pass = plan.input_passes[i];
+            if(pass.gain == 0)
+                continue;
+
+            const uint8_t *data_begin = nullptr;
+            const uint8_t *data_end = nullptr;
+            processing::mixer::meter *meter = nullptr;
+            switch(pass.source)
+            {
+#if ADC_INPUT_ENABLE
+            case ROUTE_SOURCE_LINE_IN:
+                if(g_job_mix_in_adc.result_size > 0)
+                {
+                    data_begin = g_job_mix_in_adc.data_begin;
+                    data_end = g_job_mix_in_adc.data_end;
+                }
+                meter = get_active_level_meter(LEVEL_METER_LINE_IN);
+                break;
 #endif
 #if SPDIF_INPUT_ENABLE
-        PROFILE_MEASURE_BEGIN(PROF_MIXIN_SPDIF_MIX);
-        if(g_job_mix_in_spdif.result_size > 0)
+            case ROUTE_SOURCE_SPDIF_IN:
+                if(g_job_mix_in_spdif.result_size > 0)
+                {
+                    data_begin = g_job_mix_in_spdif.data_begin;
+                    data_end = g_job_mix_in_spdif.data_end;
+                }
+                meter = get_active_level_meter(LEVEL_METER_SPDIF_IN);
+                break;
+#endif
+            case ROUTE_SOURCE_USB_OUT:
+                if(loopback_size == g_job_mix_in.buffer_size)
+                {
+                    data_begin = g_loopback_fetch_buffer.begin();
+                    data_end = g_loopback_fetch_buffer.begin() + loopback_size;
+                }
+                break;
+            }
+            if(data_begin == nullptr)
+                continue;
+
+            // a source is metered on its first crosspoint.
+            if(source_metered[pass.source])
+                meter = nullptr;
+            source_metered[pass.source] = true;
+
+            mix_input_mixing_out(g_input_mixing_buses[pass.bus], pass.gain, data_begin, data_end, !bus_mixed[pass.bus], meter);
+            bus_mixed[pass.bus] = true;
+        }
+
+        for(uint8_t bus_index = 0; bus_index < plan.input_bus_count; ++bus_index)
         {
-            mix_input_mixing_out(g_input_mixer_spdif_volume, g_job_mix_in_spdif.data_begin, g_job_mix_in_spdif.data_end, overwrite, "sin");
-            overwrite = false;
+            auto &bus = g_input_mixing_buses[bus_index];
+            const auto block_addr = bus.buffer.get_write_addr();
+            if (bus.buffer.available() < g_job_mix_in.buffer_size)
+                bus.buffer.record_overrun();
+
+            if(bus_mixed[bus_index])
+            {
+                bus.silent_bytes.store_release(0);
+                bus.buffer.commit_write(g_job_mix_in.buffer_size);
+            }
+            else
+            {
+                // silent_bytes is updated after the write position, so the reader never takes new samples as silence.
+                clear_input_mixing_out(bus, g_job_mix_in.buffer_size);
+                bus.buffer.commit_write(g_job_mix_in.buffer_size);
+                bus.silent_bytes.store_release(std::min(bus.silent_bytes.load_relaxed() + g_job_mix_in.buffer_size, bus.buffer.size()));
+            }
+
+            if (bus_index == 0 && g_spectrum_source == SPECTRUM_SOURCE_USB_IN)
+                capture_spectrum_input(bus, block_addr, g_job_mix_in.buffer_size);
+
+            if (g_limiter_enabled)
+                processing::mixer::update_limiter(bus.limiter, input_limiter_config);
         }
         PROFILE_MEASURE_END();
-#endif
-        g_input_mixing_buffer_write_addr =
-            g_input_mixing_buffer.advance(g_input_mixing_buffer_write_addr, g_job_mix_in.buffer_size);
 
+        if (g_level_meter_enabled)
+        {
+            processing::mixer::update_meter(g_level_meters[LEVEL_METER_LINE_IN], input_level_meter_config);
+            processing::mixer::update_meter(g_level_meters[LEVEL_METER_SPDIF_IN], input_level_meter_config);
+        }
+
+        g_job_mix_in.set_dependencies(input_read_job_num);
 #if ADC_INPUT_ENABLE
         g_job_mix_in_adc.result_size = 0;
         g_job_mix_in_adc.set_pending();
@@ -727,7 +1909,7 @@ namespace streaming
         g_debug_stats.inmix.processed_bytes += g_job_mix_in.buffer_size;
 #endif
 
-        g_job_mix_in.set_pending();
+        g_job_mix_in.set_pending_at(g_job_mix_in.timeout);
     }
 
 #if ADC_INPUT_ENABLE
@@ -737,11 +1919,30 @@ namespace streaming
 
         auto& job = g_job_mix_in_adc;
 
-        if (g_adc_in.is_active() && g_adc_in.is_enough_available_samples(job.require_samples))
+        // an active source is polled here until a block is in, an idle one completes empty.
+        if (g_adc_in.is_active() && !g_adc_in.is_enough_available_samples(job.require_samples))
+        {
+            job.set_pending_delay_us(200);
+            return;
+        }
+
+        if (g_adc_in.is_active())
         {
             PROFILE_MEASURE_BEGIN(PROF_MIXIN_ADC_FETCH);
-            job.result_size = g_adc_in.fetch_stream_data(job.data_begin, job.data_end);
+            const auto fetched_size = g_adc_in.fetch_stream_data(job.data_begin, job.data_end);
             PROFILE_MEASURE_END();
+
+            if (g_line_in_dynamics_staging.pending)
+                take_line_in_dynamics();
+            if (g_line_in_dynamics_enabled)
+            {
+                PROFILE_MEASURE_BEGIN(PROF_MIXIN_ADC_DYNAMICS);
+                g_line_in_dynamics.apply(job.data_begin, job.data_begin + fetched_size);
+                PROFILE_MEASURE_END();
+            }
+
+            // the fetch job mixes the block once the size is set, even from the other core on a timeout.
+            job.result_size = fetched_size;
 #if PRINT_STATS
             g_debug_stats.inmix.adc_in_samples = g_adc_in.get_available_samples();
 #endif
@@ -756,7 +1957,13 @@ namespace streaming
 
         auto& job = g_job_mix_in_spdif;
 
-        if (g_spdif_in.is_signal_active() && g_spdif_in.is_enough_available_samples(job.require_samples))
+        if (g_spdif_in.is_signal_active() && !g_spdif_in.is_enough_available_samples(job.require_samples))
+        {
+            job.set_pending_delay_us(200);
+            return;
+        }
+
+        if (g_spdif_in.is_signal_active())
         {
             PROFILE_MEASURE_BEGIN(PROF_MIXIN_SPDIF_FETCH);
             job.result_size = g_spdif_in.fetch_stream_data(job.data_begin, job.data_end);
@@ -869,23 +2076,48 @@ namespace streaming
         const uint8_t core1mask = (1 << 1);
         const uint8_t core_both_mask = core0mask | core1mask;
 
-        g_job_mix_out.set_affinity_mask(core_both_mask);
-        g_job_mix_in.set_affinity_mask(core_both_mask);
+        // the mixing jobs run ahead of usb and debug housekeeping, the spectrum only when nothing else is ready.
+        auto setup_audio_job = [](job_queue::work &job, const char* name) {
+            job.set_name(name);
+            job.set_affinity_mask(core_both_mask);
+            job.set_priority(job_queue::priority_audio);
+            job.set_deadline_us(audio_job_deadline_us);
+        };
+
+        setup_audio_job(g_job_mix_out, "mix out");
+        setup_audio_job(g_job_mix_in, "mix in");
+        g_job_spectrum.set_name("spectrum");
+        g_job_spectrum.set_affinity_mask(core0mask);
+        g_job_spectrum.set_priority(job_queue::priority_background);
 
 #if SPDIF_OUTPUT_ENABLE
-        g_job_mix_out_spdif.set_affinity_mask(core_both_mask);
+        setup_audio_job(g_job_mix_out_spdif, "mix out spdif write");
+        g_job_mix_out_spdif.add_continuation(&g_job_mix_out);
 #endif
 #if DAC_OUTPUT_ENABLE
-        g_job_mix_out_dac.set_affinity_mask(core_both_mask);
+        setup_audio_job(g_job_mix_out_dac, "mix out dac write");
+        g_job_mix_out_dac.add_continuation(&g_job_mix_out);
 #endif
 #if SPDIF_INPUT_ENABLE
         g_spdif_in.set_job_affinity_mask(core1mask);
-        g_job_mix_in_spdif.set_affinity_mask(core_both_mask);
+        g_spdif_in.set_job_priority(job_queue::priority_audio);
+        g_spdif_in.set_job_deadline_us(audio_job_deadline_us);
+        setup_audio_job(g_job_mix_in_spdif, "mix in spdif read");
+        g_job_mix_in_spdif.add_continuation(&g_job_mix_in);
 #endif
 #if ADC_INPUT_ENABLE
-        g_job_mix_in_adc.set_affinity_mask(core_both_mask);
+        setup_audio_job(g_job_mix_in_adc, "mix in adc read");
+        g_job_mix_in_adc.add_continuation(&g_job_mix_in);
 #endif
 
+        reset_limiters();
+        g_routing_plan = compile_routing();
+        critical_section_init(&g_output_eq_critical_section);
+        critical_section_init(&g_output_sharing_critical_section);
+        measure_output_eq_section_costs();
+        critical_section_init(&g_line_in_dynamics_critical_section);
+        g_line_in_dynamics_staging.parameters = g_line_in_dynamics.get_parameters();
+
         init_system();
     }
 
@@ -894,18 +2126,43 @@ namespace streaming
     {
         dbg_printf(
             "  rx:\n"
-            "    bytes: %u\n",
-            g_debug_stats.received_bytes);
+            "    bytes: %u\n"
+            "    rate: %u bytes/s\n",
+            g_debug_stats.received_bytes, g_rx_stream_buffer.get_timestamps().get_write_rate());
+#if RING_STATS_ENABLE
+        print_ring_stats("buffer", g_rx_stream_buffer.get_stats(), g_rx_stream_buffer.size());
+        g_rx_stream_buffer.reset_stats();
+#endif
         dbg_printf(
             "  tx:\n"
-            "    bytes: %u\n",
-            g_debug_stats.transfar_bytes);
+            "    bytes: %u\n"
+            "    max latency: %u us\n",
+            g_debug_stats.transfar_bytes, g_debug_stats.transfar_max_latency_us);
+#if RING_STATS_ENABLE
+        print_ring_stats("buffer", g_input_mixing_buses[0].buffer.get_stats(), g_input_mixing_buses[0].buffer.size());
+        g_input_mixing_buses[0].buffer.reset_stats();
+        print_ring_stats("loopback", g_loopback_buffer.get_stats(), g_loopback_buffer.size());
+        g_loopback_buffer.reset_stats();
+#endif
         dbg_printf(
             "  outmix:\n"
             "    src left: %u/%u\n"
             "    input left: %u/%u\n"
             "    processed bytes: %u\n",
-            g_debug_stats.outmix.src_left, g_rx_stream_buffer.size(), g_debug_stats.outmix.input_left, g_input_mixing_buffer.size(), g_debug_stats.outmix.processed_bytes);
+            g_debug_stats.outmix.src_left, g_rx_stream_buffer.size(), g_debug_stats.outmix.input_left, g_input_mixing_buses[0].buffer.size(), g_debug_stats.outmix.processed_bytes);
+        dbg_printf(
+            "    eq: %u/%u sections\n",
+            g_output_equalizers[0].get_section_count(), g_output_eq_max_sections);
+        // per section and sink, in tenths of a percent of a core.
+        for (const auto &cost : g_output_eq_section_costs)
+        {
+            const auto per_mille = [&](uint32_t sampling_frequency) {
+                return uint32_t(uint64_t(cost.cycles_per_sample) * device_output_channels * sampling_frequency * 1000 / clock_get_hz(clk_sys));
+            };
+            dbg_printf(
+                "    eq %ubit: %u cycles per section sample, %u.%u%% at 48kHz, %u.%u%% at 96kHz\n",
+                cost.bits, cost.cycles_per_sample, per_mille(48000) / 10, per_mille(48000) % 10, per_mille(96000) / 10, per_mille(96000) % 10);
+        }
 #if SPDIF_OUTPUT_ENABLE
         g_spdif_out.print_stats();
 #endif
@@ -919,6 +2176,12 @@ namespace streaming
             "    spdif in left: %u\n"
             "    processed bytes: %u\n",
             g_debug_stats.inmix.adc_in_samples, g_debug_stats.inmix.spdif_in_samples, g_debug_stats.inmix.processed_bytes);
+#if ADC_INPUT_ENABLE
+        g_adc_in.print_stats();
+#endif
+#if SPDIF_INPUT_ENABLE
+        g_spdif_in.print_stats();
+#endif
 
         g_debug_stats = {};
     }
@@ -1,9 +1,68 @@
 ﻿#pragma once
 
+#include "mixer.h"
 
 namespace streaming
 {
 
+enum level_meter_source
+{
+    LEVEL_METER_LINE_IN,
+    LEVEL_METER_SPDIF_IN,
+    LEVEL_METER_USB_OUT,
+    LEVEL_METER_SOURCE_NUM
+};
+
+enum route_source
+{
+    ROUTE_SOURCE_USB_OUT,
+    ROUTE_SOURCE_LINE_IN,
+    ROUTE_SOURCE_SPDIF_IN,
+    ROUTE_SOURCE_NUM
+};
+
+enum route_sink
+{
+    ROUTE_SINK_DAC,
+    ROUTE_SINK_SPDIF_OUT,
+    ROUTE_SINK_USB_IN,
+    ROUTE_SINK_NUM
+};
+
+enum spectrum_source
+{
+    SPECTRUM_SOURCE_USB_IN,
+    SPECTRUM_SOURCE_DAC,
+    SPECTRUM_SOURCE_NUM
+};
+
+// the mixer's meter record, sent as is by the level meter control request.
+using level_meter_value = processing::mixer::level;
+static_assert(sizeof(level_meter_value) == 3 * sizeof(uint16_t), "the control request sends three uint16 per meter");
+
+// biquad coefficients in Q2.30 normalized with a0. y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2
+struct eq_section
+{
+    int32_t b0;
+    int32_t b1;
+    int32_t b2;
+    int32_t a1;
+    int32_t a2;
+};
+
+constexpr uint8_t max_output_eq_sections = 8;
+
+// levels and gains in 1/256 dB. the envelope holds while the level is under gate_db.
+struct dynamics_parameters
+{
+    int16_t threshold_db;
+    int16_t makeup_db;
+    int16_t gate_db;
+    uint16_t attack_ms;
+    uint16_t release_ms;
+    uint8_t ratio;
+};
+
 void test();
 
 void init();
@@ -21,6 +80,51 @@ void set_spdif_in_volume(uint8_t value);
 void set_line_in_volume(uint8_t value);
 uint8_t get_spdif_in_volume();
 uint8_t get_line_in_volume();
+void set_spdif_in_volume_db(int16_t value);
+void set_line_in_volume_db(int16_t value);
+int16_t get_spdif_in_volume_db();
+int16_t get_line_in_volume_db();
+
+void set_level_meter_enabled(bool enabled);
+bool is_level_meter_enabled();
+level_meter_value get_level_meter(uint8_t source, uint8_t channel);
+
+// soft limiter on the sum of the input sources and on the monitor mix. enabled by default.
+void set_limiter_enabled(bool enabled);
+bool is_limiter_enabled();
+
+// crosspoint volume of the routing matrix in 1/256 dB. -127dB mutes the crosspoint and removes it from processing.
+// the volume of line-in and spdif-in applies on top of it. USB OUT to USB IN is the loopback of the playback stream.
+void set_route_volume_db(uint8_t source, uint8_t sink, int16_t value);
+int16_t get_route_volume_db(uint8_t source, uint8_t sink);
+
+// crossfade length in frames when the output format or the routing changes. 0 switches without blending.
+// from a running output the fade is cut to one processing block, the length of the outgoing tail.
+void set_transition_frames(uint16_t frames);
+uint16_t get_transition_frames();
+
+// equalizer on the DAC and SPDIF out. the sections are applied from the next processing block. 0 sections bypasses it.
+// only as many sections as fit the cost budget at the current format and routing are applied, the rest stay staged.
+void set_output_eq(const eq_section* sections, uint8_t count);
+uint8_t get_output_eq(eq_section* sections, uint8_t max_count);
+uint8_t get_output_eq_max_sections();
+
+// compressor with makeup gain on line-in before it's mixed. disabled by default.
+void set_line_in_dynamics_enabled(bool enabled);
+bool is_line_in_dynamics_enabled();
+void set_line_in_dynamics(const dynamics_parameters& params);
+dynamics_parameters get_line_in_dynamics();
+int16_t get_line_in_dynamics_gain_db();
+
+// spectrum of the USB IN mix or the DAC output, computed on spare cycles. points is 256 or 1024.
+// bins are 1/256 dB and 0dB is a full scale sine. get_spectrum returns the number of bins.
+void set_spectrum_enabled(bool enabled);
+bool is_spectrum_enabled();
+void set_spectrum_source(uint8_t source);
+uint8_t get_spectrum_source();
+void set_spectrum_points(uint16_t points);
+uint16_t get_spectrum_points();
+uint16_t get_spectrum(int16_t* bins, uint16_t max_count);
 
 void print_debug_stats();
 
@@ -38,6 +38,10 @@ namespace streaming
         bool is_enough_available_samples(size_t fetch_require_samples) const;
         bool is_active() const;
 
+#if PRINT_STATS
+        void print_stats();
+#endif
+
         static constexpr size_t get_buffer_size(uint16_t duration_ms) { return max_input_samples_1ms*duration_ms; }
         template<uint16_t DurationMS> using buffer = std::array<uint32_t, get_buffer_size(DurationMS)>;
     private:
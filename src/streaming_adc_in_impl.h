@@ -137,7 +137,9 @@ size_t adc_in::fetch_stream_data(uint8_t* buffer_begin, uint8_t* buffer_end)
     constexpr uint32_t frame_bytes = bits_to_bytes(adc_in_resolution_bits) * device_input_channels;
     auto write_addr = (uint32_t*)((adc_dma->write_addr/frame_bytes)*frame_bytes);
 
-    if(m_stream_buffer.distance((uint32_t*)write_addr, m_stream_buffer_read_addr) < device_input_channels)
+    const auto available_samples = m_stream_buffer.distance((uint32_t*)write_addr, m_stream_buffer_read_addr);
+    m_stream_buffer.record_fill(available_samples);
+    if(available_samples < device_input_channels)
         return 0;
 
     m_stream_buffer_read_addr = m_stream_buffer.apply_linear(write_addr, m_stream_buffer_read_addr, 
@@ -157,4 +159,18 @@ bool adc_in::is_active() const
     return m_stream_buffer_read_addr != nullptr;
 }
 
+#if PRINT_STATS
+void adc_in::print_stats()
+{
+    dbg_printf(
+        "  adc in:\n"
+        "    left: %u/%u\n",
+        m_running ? get_available_samples() : 0, m_stream_buffer.size());
+#if RING_STATS_ENABLE
+    print_ring_stats("buffer", m_stream_buffer.get_stats(), m_stream_buffer.size());
+    m_stream_buffer.reset_stats();
+#endif
+}
+#endif
+
 }
\ No newline at end of file
@@ -28,6 +28,8 @@ namespace streaming
         void start();
         void stop();
         void set_format(uint32_t sampling_frequency, uint32_t bits);
+        // changes the format of the data written from now on without stopping the stream.
+        void set_resolution(uint32_t bits) { m_resolution_bits = bits; }
         size_t write(const uint8_t* begin, const uint8_t* end);
         void on_dma_isr();
 
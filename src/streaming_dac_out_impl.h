@@ -116,6 +116,10 @@ namespace streaming
 
     size_t dac_out::write(const uint8_t* begin, const uint8_t* end)
     {
+#if RING_STATS_ENABLE
+        m_stream_buffer.record_fill(get_buffer_available_samples());
+#endif
+
         auto p = begin;
         while (p < end)
         {
@@ -168,6 +172,10 @@ namespace streaming
             "    consumed: %u\n",
             m_debug_available_samples, m_stream_buffer.size(),
             get_consumed_samples());
+#if RING_STATS_ENABLE
+        print_ring_stats("buffer", m_stream_buffer.get_stats(), m_stream_buffer.size());
+        m_stream_buffer.reset_stats();
+#endif
     }
 #endif
 
@@ -31,10 +31,15 @@ namespace streaming
         void start();
         void stop();
         void set_job_affinity_mask(uint8_t affinity);
+        void set_job_priority(uint8_t priority);
+        void set_job_deadline_us(uint32_t deadline);
         void set_output_format(uint32_t freq, uint8_t bits);
         uint32_t get_sampling_frequency(bool indicated_by_status);
         uint8_t get_resolution_bits();
         size_t get_available_samples() const;
+#if PRINT_STATS
+        void print_stats();
+#endif
         size_t fetch_stream_data(uint8_t *buffer_begin, uint8_t *buffer_end);
         bool is_signal_active() const { return m_signal_active; }
         bool is_enough_available_samples(size_t fetch_require_samples) const;
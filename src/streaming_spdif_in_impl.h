@@ -155,6 +155,20 @@ namespace streaming
         return m_stream_buffer.distance((uint32_t*)spdif_dma->write_addr, m_stream_buffer_read_addr);
     }
 
+#if PRINT_STATS
+    void spdif_in::print_stats()
+    {
+        dbg_printf(
+            "  spdif in:\n"
+            "    left: %u/%u\n",
+            get_available_samples(), m_stream_buffer.size());
+#if RING_STATS_ENABLE
+        print_ring_stats("buffer", m_stream_buffer.get_stats(), m_stream_buffer.size());
+        m_stream_buffer.reset_stats();
+#endif
+    }
+#endif
+
     bool spdif_in::is_enough_available_samples(size_t fetch_require_samples) const
     {
         return get_available_samples() > m_converter.get_requirement_src_samples(fetch_require_samples);
@@ -175,6 +189,7 @@ namespace streaming
         auto dst_end = buffer_begin + round_frame_bytes(buffer_end - buffer_begin, m_output_resolution_bits, device_input_channels);
 
         auto write_addr = (uint32_t*)spdif_dma->write_addr;
+        m_stream_buffer.record_fill(m_stream_buffer.distance(write_addr, m_stream_buffer_read_addr));
         while(m_stream_buffer_read_addr != write_addr && dst < dst_end && is_signal_active())
         {
             std::move(m_config.temp_begin + m_fetch_temp_top, m_config.temp_begin + m_fetch_temp_tail, m_config.temp_begin);
@@ -552,6 +567,7 @@ namespace streaming
         m_job_work.method = &spdif_in::job_init;
 
         m_job_work.this_ptr = this;
+        m_job_work.set_name("spdif in");
         m_job_work.activate();
         m_job_work.set_pending();
 
@@ -577,6 +593,16 @@ namespace streaming
     {
         m_job_work.set_affinity_mask(affinity);
     }
+
+    void spdif_in::set_job_priority(uint8_t priority)
+    {
+        m_job_work.set_priority(priority);
+    }
+
+    void spdif_in::set_job_deadline_us(uint32_t deadline)
+    {
+        m_job_work.set_deadline_us(deadline);
+    }
     
     void spdif_in::on_dma_isr()
     {
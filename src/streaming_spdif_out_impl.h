@@ -160,6 +160,10 @@ void spdif_out::set_format(uint32_t sampling_frequency, uint32_t bits)
 
 size_t spdif_out::write(const uint8_t *begin, const uint8_t * end)
 {
+#if RING_STATS_ENABLE
+    m_stream_buffer.record_fill(get_buffer_available_samples());
+#endif
+
     auto p = begin;
     while(p < end)
     {
@@ -215,6 +219,10 @@ void spdif_out::print_stats()
         "    consumed: %u\n",
         m_debug_available_samples, m_stream_buffer.size(),
         get_consumed_samples());
+#if RING_STATS_ENABLE
+    print_ring_stats("buffer", m_stream_buffer.get_stats(), m_stream_buffer.size());
+    m_stream_buffer.reset_stats();
+#endif
 }
 #endif
 
@@ -1,6 +1,7 @@
 #include <iterator>
 #include <hardware/dma.h>
 #include "support.h"
+#include "debug.h"
 
 namespace support
 {
@@ -77,4 +78,21 @@ namespace support
         hw_set_bits(&dma_hw->ch[ch2].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
     }
 
+#if PRINT_STATS && RING_STATS_ENABLE
+    void print_ring_stats(const char* name, const data_structure::ring_stats& stats, size_t size)
+    {
+        uint32_t records = 0;
+        for(auto count : stats.histogram)
+            records += count;
+
+        dbg_printf(
+            "    %s fill: %u-%u/%u  overruns: %u  underruns: %u\n"
+            "      histogram:",
+            name, records ? stats.min_fill : 0, stats.max_fill, size, stats.overruns, stats.underruns);
+        for(auto count : stats.histogram)
+            dbg_printf(" %u", count);
+        dbg_printf("\n");
+    }
+#endif
+
 }
\ No newline at end of file
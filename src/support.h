@@ -1,6 +1,7 @@
 #pragma once
 #include <hardware/pio.h>
 #include "device_config.h"
+#include "circular_buffer.h"
 
 namespace support
 {
@@ -97,6 +98,49 @@ namespace support
         }
     }
 
+    template<uint8_t Bits> uint32_t saturate_value(int32_t value)
+    {
+        static_assert(Bits > 0 && Bits < 32);
+
+        constexpr int32_t min_value = (int32_t)(0xffffffff << (Bits - 1));
+        constexpr int32_t max_value = (int32_t)((1 << (Bits - 1)) - 1);
+
+        if(value > max_value)
+            return max_value;
+        else if(value < min_value)
+            return min_value;
+        return value;
+    }
+
+    // multiply a signed sample by an unsigned Q1.15 gain.
+    // the result may exceed the range of Bits when the gain is above unity.
+    template<uint8_t Bits> uint32_t apply_gain(uint32_t value, uint16_t gain)
+    {
+        static_assert(Bits > 0 && Bits <= 32);
+
+        if constexpr (Bits >= 32)
+        {
+            const int64_t result = ((int64_t)(int32_t)value * gain) >> 15;
+            if(result > INT32_MAX)
+                return INT32_MAX;
+            else if(result < INT32_MIN)
+                return (uint32_t)INT32_MIN;
+            return (uint32_t)result;
+        }
+        else if constexpr (Bits > 16)
+        {
+            // split the sample so that each product fits in 32bits.
+            constexpr uint8_t shift = Bits - 16;
+            const int32_t hi = (int32_t)value >> shift;
+            const uint32_t lo = value & ((1 << shift) - 1);
+            return (uint32_t)((hi*(int32_t)gain + (int32_t)((lo*gain) >> shift)) >> (15 - shift));
+        }
+        else
+        {
+            return (uint32_t)(((int32_t)value*(int32_t)gain) >> 15);
+        }
+    }
+
     inline uint32_t is_bits_odd(uint32_t value)
     {
         value ^= value >> 16;
@@ -114,4 +158,8 @@ namespace support
 
     inline PIO get_pio(int index) { return (index==0) ? pio0 : pio1; }
 
+#if PRINT_STATS && RING_STATS_ENABLE
+    void print_ring_stats(const char* name, const data_structure::ring_stats& stats, size_t size);
+#endif
+
 }
\ No newline at end of file
@@ -198,15 +198,15 @@ void test_mixer(uint8_t bits, bool use_interp)
         src1_array[i] = value, value += (value_range/src1_array.size());
     src2_array.fill(0xcccccccc);
 
-    mixer.apply(0x80, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), true);
+    mixer.apply(processing::mixer::unity_gain/2, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), true);
     print_src("half");    
 
     src2_array.fill(value_max/2);
-    mixer.apply(0xff, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), false);
+    mixer.apply(processing::mixer::unity_gain, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), false);
     print_src("max_sat");
 
     src2_array.fill(value_min/2);
-    mixer.apply(0xff, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), false);
+    mixer.apply(processing::mixer::unity_gain, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), false);
     print_src("min_sat");
 
 }
@@ -241,9 +241,9 @@ void measure_mixer(uint8_t bits, bool use_interp)
 
     auto time = time_us_32();
 
-    mixer.apply(0x80, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), true);
+    mixer.apply(processing::mixer::unity_gain/2, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), true);
 
-    mixer.apply(0xff, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), false);
+    mixer.apply(processing::mixer::unity_gain, (uint8_t*)src1_array.begin(), (uint8_t*)src1_array.end(), (uint8_t*)src2_array.begin(), (uint8_t*)src2_array.end(), false);
 
     dbg_printf("spent %u\n", time_us_32() - time);
 }
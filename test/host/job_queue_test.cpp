@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "debug.h"
+#include "job_queue.h"
+
+// the scheduling policies of job_queue on host threads. the ordering and timing cases run on the calling thread as
+// core0 against the virtual clock, the ones about cores and sleeping launch the other core on the real clock.
+
+namespace
+{
+    struct test_checker
+    {
+        const char* name;
+        uint32_t failures = 0;
+
+        void operator()(bool result, const char* label)
+        {
+            if (!result)
+            {
+                ++failures;
+                dbg_printf("  %s failed\n", label);
+            }
+        }
+
+        bool report()
+        {
+            dbg_printf("  %s %s, %u failures\n", name, failures ? "failed" : "ok", failures);
+            return failures == 0;
+        }
+    };
+
+    struct test_job : public job_queue::work
+    {
+        std::function<void()> fn;
+        std::atomic<uint32_t> runs{0};
+
+        void operator()() override
+        {
+            ++runs;
+            if (fn)
+                fn();
+        }
+    };
+
+    // runs every due job on the calling core.
+    void drain()
+    {
+        while (job_queue::system::execute())
+            ;
+    }
+
+    // the other core runs the jobs until stop().
+    struct test_core
+    {
+        std::thread thread;
+
+        explicit test_core(uint8_t core) : thread(host::launch_core(core, [] { job_queue::system::run(); })) {}
+        ~test_core()
+        {
+            job_queue::system::stop();
+            thread.join();
+            job_queue::system::init();
+        }
+    };
+
+    bool wait_for(const std::function<bool()> &cond, uint32_t timeout_ms)
+    {
+        const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!cond())
+        {
+            if (std::chrono::steady_clock::now() > until)
+                return false;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        return true;
+    }
+}
+
+// higher priority first, the earliest deadline first within one, then the order queued. a job started after its
+// deadline counts a miss on itself and on the system.
+bool test_priority()
+{
+    test_checker check = { "priority and deadline" };
+    host::use_virtual_clock(true);
+    host::set_time_us(1000);
+
+    std::vector<int> order;
+    std::array<test_job, 6> jobs;
+    const uint8_t priorities[] = {
+        job_queue::priority_background, job_queue::priority_normal, job_queue::priority_normal,
+        job_queue::priority_audio, job_queue::priority_audio, job_queue::priority_normal};
+    const uint32_t deadlines[] = {0, 0, 0, 500, 200, 100};
+    for (int i = 0; i < int(jobs.size()); ++i)
+    {
+        jobs[i].fn = [&order, i] { order.push_back(i); };
+        jobs[i].set_affinity_mask(1);
+        jobs[i].set_priority(priorities[i]);
+        jobs[i].set_deadline_us(deadlines[i]);
+        jobs[i].activate();
+        jobs[i].set_pending();
+    }
+    drain();
+    check(order == std::vector<int>({4, 3, 5, 1, 2, 0}), "dispatch order");
+
+    // the heads of the core's own queue and the shared one are weighed the same way.
+    order.clear();
+    const uint8_t masks[] = {1, 1, 3, 3};
+    const uint8_t queue_priorities[] = {job_queue::priority_normal, job_queue::priority_background, job_queue::priority_normal, job_queue::priority_audio};
+    const uint32_t queue_deadlines[] = {300, 0, 100, 0};
+    for (int i = 0; i < 4; ++i)
+    {
+        jobs[i].set_affinity_mask(masks[i]);
+        jobs[i].set_priority(queue_priorities[i]);
+        jobs[i].set_deadline_us(queue_deadlines[i]);
+        jobs[i].set_pending();
+    }
+    drain();
+    check(order == std::vector<int>({3, 2, 0, 1}), "dispatch order across queues");
+    for (int i = 0; i < 4; ++i)
+    {
+        jobs[i].set_affinity_mask(1);
+        jobs[i].set_priority(priorities[i]);
+        jobs[i].set_deadline_us(deadlines[i]);
+    }
+
+    const auto misses = job_queue::system::get_deadline_misses();
+    jobs[3].set_pending();
+    jobs[4].set_pending();
+    host::advance_time_us(300);
+    drain();
+    check(jobs[4].get_deadline_misses() == 1 && jobs[3].get_deadline_misses() == 0, "deadline miss per job");
+    check(job_queue::system::get_deadline_misses() == misses + 1, "deadline miss total");
+
+    for (auto &job : jobs)
+        job.deactivate();
+    return check.report();
+}
+
+// a delayed job becomes due after its time, and the earliest delayed one is the next wake time. one delayed again
+// moves in the heap, and jobs past the heap size are queued as due and counted.
+bool test_delayed()
+{
+    test_checker check = { "delayed" };
+    host::use_virtual_clock(true);
+    host::set_time_us(1000);
+
+    std::vector<int> order;
+    std::array<test_job, 3> jobs;
+    const uint32_t delays[] = {300, 100, 200};
+    for (int i = 0; i < int(jobs.size()); ++i)
+    {
+        jobs[i].fn = [&order, i] { order.push_back(i); };
+        jobs[i].set_affinity_mask(1);
+        jobs[i].activate();
+        jobs[i].set_pending_delay_us(delays[i]);
+    }
+    check(job_queue::system::get_next_wake_time() == 1100, "next wake time");
+    check(!job_queue::system::execute(), "nothing due early");
+
+    host::set_time_us(1101);
+    drain();
+    check(order == std::vector<int>({1}), "due job promoted");
+    check(job_queue::system::get_next_wake_time() == 1200, "next wake time after promotion");
+
+    jobs[0].set_pending_at(1150);
+    check(job_queue::system::get_next_wake_time() == 1150, "delayed again earlier");
+
+    host::set_time_us(2000);
+    drain();
+    check(order == std::vector<int>({1, 0, 2}), "due order");
+    check(job_queue::system::get_next_wake_time() == UINT64_MAX, "nothing pending");
+
+    // one more than the heap holds.
+    std::array<test_job, 17> overflow_jobs;
+    const auto overflows = job_queue::system::get_delayed_overflows();
+    for (auto &job : overflow_jobs)
+    {
+        job.set_affinity_mask(1);
+        job.activate();
+        job.set_pending_delay_us(100);
+    }
+    check(job_queue::system::get_delayed_overflows() == overflows + 1, "heap overflow counted");
+    drain();
+    host::advance_time_us(200);
+    drain();
+    bool all_ran = true;
+    for (auto &job : overflow_jobs)
+        all_ran &= job.runs == 1;
+    check(all_ran, "heap overflow runs every job");
+
+    for (auto &job : jobs)
+        job.deactivate();
+    for (auto &job : overflow_jobs)
+        job.deactivate();
+    return check.report();
+}
+
+// a job bound to a core runs only there, one allowed on both runs on either.
+bool test_affinity()
+{
+    test_checker check = { "affinity" };
+    host::use_virtual_clock(true);
+    host::set_time_us(1000);
+
+    test_job core1_job;
+    core1_job.set_affinity_mask(2);
+    core1_job.activate();
+    core1_job.set_pending();
+    check(!job_queue::system::execute() && job_queue::system::get_next_wake_time() == UINT64_MAX, "other core's job not taken");
+    host::set_core_num(1);
+    check(job_queue::system::execute() && core1_job.runs == 1, "own core's job taken");
+    host::set_core_num(0);
+    core1_job.deactivate();
+
+    host::use_virtual_clock(false);
+    constexpr uint32_t rounds = 200;
+    std::array<test_job, 3> jobs;
+    std::array<std::array<uint32_t, 2>, 3> cores = {};
+    for (int i = 0; i < int(jobs.size()); ++i)
+    {
+        jobs[i].fn = [&cores, i] { ++cores[i][get_core_num()]; };
+        jobs[i].set_affinity_mask(i + 1);
+        jobs[i].activate();
+    }
+    {
+        test_core core0(0);
+        test_core core1(1);
+        for (uint32_t round = 0; round < rounds; ++round)
+        {
+            // the calling thread is core0 as well, so it polls instead of wait_done().
+            for (auto &job : jobs)
+                job.set_pending();
+            if (!wait_for([&] { return jobs[0].is_idle() && jobs[1].is_idle() && jobs[2].is_idle(); }, 1000))
+            {
+                check(false, "jobs done");
+                break;
+            }
+        }
+    }
+    check(cores[0][1] == 0 && cores[0][0] > 0, "core0 job on core0 only");
+    check(cores[1][0] == 0 && cores[1][1] > 0, "core1 job on core1 only");
+    check(cores[2][0] + cores[2][1] > 0, "shared job runs");
+
+    for (auto &job : jobs)
+        job.deactivate();
+    return check.report();
+}
+
+// a core asleep with nothing pending wakes on set_pending() from the other, and the sleep counts as idle.
+bool test_idle()
+{
+    test_checker check = { "idle" };
+    host::use_virtual_clock(false);
+
+    test_job job;
+    uint64_t pended_at = 0;
+    uint64_t ran_at = 0;
+    job.fn = [&] { ran_at = time_us_64(); };
+    job.set_affinity_mask(2);
+    job.activate();
+
+    const auto idle_us = job_queue::system::get_idle_us(1);
+    {
+        test_core core1(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pended_at = time_us_64();
+        job.set_pending();
+        check(wait_for([&] { return job.runs == 1; }, 1000), "woken by set_pending");
+        job.wait_done();
+    }
+    check(ran_at >= pended_at, "ran after pending");
+    check(job_queue::system::get_idle_us(1) - idle_us >= 10000, "sleep counted as idle");
+
+    job.deactivate();
+    return check.report();
+}
+
+// a continuation waits for as many completions as it has dependencies, and with none pends on each. a job made
+// pending from inside its run has not completed.
+bool test_dependencies()
+{
+    test_checker check = { "dependencies" };
+    host::use_virtual_clock(true);
+    host::set_time_us(1000);
+
+    test_job first;
+    test_job second;
+    test_job next;
+    for (auto *job : {&first, &second, &next})
+    {
+        job->set_affinity_mask(1);
+        job->activate();
+    }
+    first.add_continuation(&next);
+    second.add_continuation(&next);
+
+    next.set_dependencies(2);
+    first.set_pending();
+    drain();
+    check(next.runs == 0 && next.get_remaining_dependencies() == 1, "one of two completed");
+    second.set_pending();
+    drain();
+    check(next.runs == 1 && next.get_remaining_dependencies() == 0, "both completed");
+
+    first.set_pending();
+    drain();
+    check(next.runs == 2, "each completion with none remaining");
+
+    bool again = true;
+    first.fn = [&] {
+        if (again)
+            first.set_pending();
+        again = false;
+    };
+    first.set_pending();
+    job_queue::system::execute();
+    check(next.runs == 2 && next.is_idle() && !first.is_idle(), "pending again is no completion");
+    drain();
+    check(first.runs == 4 && next.runs == 3, "completion after the last run");
+
+    for (auto *job : {&first, &second, &next})
+        job->deactivate();
+    return check.report();
+}
+
+// wait_done() returns at once for an idle job, false after the timeout while a run lasts, and true at its end with
+// the run's writes visible.
+bool test_wait_done()
+{
+    test_checker check = { "wait_done" };
+    host::use_virtual_clock(false);
+
+    test_job job;
+    std::atomic<bool> release{false};
+    bool finished = false;
+    job.fn = [&] {
+        while (!release)
+            std::this_thread::yield();
+        finished = true;
+    };
+    job.set_affinity_mask(2);
+    job.activate();
+    check(job.wait_done(0), "idle job");
+
+    {
+        test_core core1(1);
+        job.set_pending();
+        check(wait_for([&] { return job.runs == 1; }, 1000), "job started");
+        check(!job.wait_done(5000), "timeout while running");
+        std::thread releaser([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            release = true;
+        });
+        check(job.wait_done() && finished, "done without a timeout");
+        releaser.join();
+    }
+
+    job.deactivate();
+    return check.report();
+}
+
+int main()
+{
+    // a failed dbg_assert aborts, the case it failed in must already be out.
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    job_queue::system::init();
+
+    bool result = true;
+    result &= test_priority();
+    result &= test_delayed();
+    result &= test_affinity();
+    result &= test_idle();
+    result &= test_dependencies();
+    result &= test_wait_done();
+
+    dbg_printf("%s\n", result ? "all ok" : "failed");
+    return result ? 0 : 1;
+}
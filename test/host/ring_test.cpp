@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <array>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "debug.h"
+#include "circular_buffer.h"
+
+// the ring buffers against models, each run replays from its seed.
+//   ring_test [iterations]    fuzzes every ring over seeds 1..16
+//   ring_test measure         times circular_buffer in bytes per call
+
+namespace
+{
+    // xorshift, so a failing seed replays the same on the host and on the device.
+    uint32_t test_random(uint32_t &state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    struct test_checker
+    {
+        const char* name;
+        uint32_t failures = 0;
+
+        void operator()(bool result, const char* label, uint32_t iteration)
+        {
+            if (!result && failures++ < 8)
+                dbg_printf("  %s failed at %u\n", label, iteration);
+        }
+
+        bool report()
+        {
+            dbg_printf("  %s %s, %u failures\n", name, failures ? "failed" : "ok", failures);
+            return failures == 0;
+        }
+    };
+}
+
+// every circular_buffer method against a model that walks the ring one element at a time.
+// positions are offsets from begin() in [0, size], end() included.
+bool test_circular_buffer(uint32_t seed, uint32_t iterations)
+{
+    constexpr size_t capacity = 61;
+    using ring_type = data_structure::circular_buffer<data_structure::container_array<uint8_t, capacity>>;
+
+    static ring_type ring;
+    static std::array<uint8_t, capacity> model;
+    static std::array<uint8_t, capacity * 2> src;
+    static std::array<uint8_t, capacity * 2> dst;
+
+    uint32_t state = seed;
+    test_checker check = { "circular_buffer" };
+
+    ring.resize(capacity);
+    for (size_t i = 0; i < capacity; ++i)
+        model[i] = ring.begin()[i] = test_random(state);
+
+    // end() is where begin() is once anything moves on from it.
+    size_t size = capacity;
+    auto model_step = [&](size_t pos) { return pos + 1 >= size ? 0 : pos + 1; };
+    auto model_index = [&](size_t start, size_t count) {
+        auto pos = start == size ? 0 : start;
+        for (size_t n = 0; n < count; ++n)
+            pos = model_step(pos);
+        return pos;
+    };
+    auto model_wrap = [&](size_t start, size_t count) { return count ? model_index(start, count) : start; };
+    auto model_distance = [&](size_t limit, size_t start) {
+        if (start <= limit)
+            return limit - start;
+        size_t count = 0;
+        for (auto pos = model_index(start, 0); pos != limit; pos = model_step(pos))
+            ++count;
+        return count;
+    };
+
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        if (test_random(state) % 64 == 0)
+        {
+            size = 1 + test_random(state) % capacity;
+            ring.resize(size);
+            check(ring.size() == size && ring.capacity() == capacity && ring.end() == ring.begin() + size, "resize", iteration);
+        }
+
+        const size_t start = test_random(state) % (size + 1);
+        const size_t limit = test_random(state) % (size + 1);
+        const size_t count = test_random(state) % (size * 2);
+        const auto p_start = ring.begin() + start;
+        const auto p_limit = ring.begin() + limit;
+        const auto dist = model_distance(limit, start);
+        const auto clamped = std::min(count, dist);
+
+        switch (test_random(state) % 8)
+        {
+        case 0:
+            check(ring.distance(p_limit, p_start) == dist, "distance", iteration);
+            check(ring.distance(p_start) == size - start, "distance to end", iteration);
+            break;
+
+        case 1:
+        {
+            // a range wrapping past end() starts over from begin() even when nothing is taken.
+            const auto expected = clamped == dist ? limit : start > limit ? model_index(start, clamped) : start + clamped;
+            check(ring.advance(p_limit, p_start, count) == ring.begin() + expected, "advance limited", iteration);
+            break;
+        }
+
+        case 2:
+            check(ring.advance(p_start, count) == ring.begin() + ((start + count) % size), "advance", iteration);
+            break;
+
+        case 3:
+        {
+            const auto next = ring.copy_to(p_limit, p_start, dst.begin(), count);
+            check(next == ring.begin() + model_wrap(start, clamped), "copy_to limited", iteration);
+            bool same = true;
+            for (size_t n = 0, pos = model_index(start, 0); n < clamped; ++n, pos = model_step(pos))
+                same &= dst[n] == model[pos];
+            check(same, "copy_to limited data", iteration);
+            break;
+        }
+
+        case 4:
+        {
+            const auto n = std::min(count, size);
+            const auto next = ring.copy_to(p_start, dst.begin(), n);
+            check(next == ring.begin() + model_wrap(start, n), "copy_to", iteration);
+            bool same = true;
+            for (size_t k = 0, pos = model_index(start, 0); k < n; ++k, pos = model_step(pos))
+                same &= dst[k] == model[pos];
+            check(same, "copy_to data", iteration);
+            break;
+        }
+
+        case 5:
+        {
+            const auto n = std::min(count, size);
+            for (size_t k = 0; k < n; ++k)
+                src[k] = test_random(state);
+            const auto next = ring.write(p_start, src.begin(), n);
+            check(next == ring.begin() + model_wrap(start, n), "write", iteration);
+            for (size_t k = 0, pos = model_index(start, 0); k < n; ++k, pos = model_step(pos))
+                model[pos] = src[k];
+            check(std::equal(ring.begin(), ring.begin() + size, model.begin()), "write data", iteration);
+            break;
+        }
+
+        case 6:
+        {
+            size_t n = 0;
+            bool same = true;
+            auto pos = model_index(start, 0);
+            for (const auto &span : ring.readable_spans(p_limit, p_start))
+            {
+                for (auto p = span.begin(); p != span.end(); ++p, ++n, pos = model_step(pos))
+                    same &= n < dist && *p == model[pos];
+            }
+            check(same && n == dist, "readable_spans", iteration);
+            break;
+        }
+
+        case 7:
+        {
+            // each piece is consumed partly at random, like a converter stopping short of a whole frame.
+            size_t consumed = 0;
+            bool same = true;
+            auto pos = model_index(start, 0);
+            const auto next = ring.apply_linear(p_limit, p_start, [&](const uint8_t *begin, const uint8_t *end) {
+                const size_t n = std::min<size_t>(end - begin, test_random(state) % (size + 1));
+                for (size_t k = 0; k < n; ++k, pos = model_step(pos))
+                    same &= begin[k] == model[pos];
+                consumed += n;
+                return n;
+            });
+            check(same && consumed <= dist, "apply_linear data", iteration);
+            check(next == ring.advance(p_limit, p_start, consumed), "apply_linear", iteration);
+            break;
+        }
+        }
+    }
+
+    return check.report();
+}
+
+// masked_circular_buffer against a queue of the stored elements. the guard mirror is checked through the data every
+// piece that runs over the seam returns.
+template<size_t Guard>
+bool test_masked_circular_buffer(uint32_t seed, uint32_t iterations)
+{
+    constexpr size_t capacity = 64;
+    using ring_type = data_structure::masked_circular_buffer<uint8_t, capacity, Guard>;
+
+    static ring_type ring;
+    static std::array<uint8_t, capacity * 2> src;
+    static std::array<uint8_t, capacity * 2> dst;
+    std::deque<uint8_t> model;
+
+    uint32_t state = seed;
+    test_checker check = { Guard ? "masked_circular_buffer guard" : "masked_circular_buffer" };
+
+    size_t size = capacity;
+    ring.resize(size);
+
+    auto check_data = [&](const uint8_t *p, size_t count, size_t from) {
+        bool same = from + count <= model.size();
+        for (size_t k = 0; same && k < count; ++k)
+            same = p[k] == model[from + k];
+        return same;
+    };
+    auto model_read = [&](size_t count) { model.erase(model.begin(), model.begin() + count); };
+
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        if (test_random(state) % 256 == 0)
+        {
+            size = 1 + test_random(state) % capacity;
+            ring.resize(size);
+            model.clear();
+            check(ring.size() == size && ring.used() == 0 && ring.get_read_counter() == 0, "resize", iteration);
+        }
+
+        const size_t count = test_random(state) % (capacity + Guard + 1);
+
+        switch (test_random(state) % 6)
+        {
+        case 0:
+        {
+            for (size_t k = 0; k < count; ++k)
+                src[k] = test_random(state);
+            const auto expected = std::min(count, size - model.size());
+            check(ring.write(src.data(), count) == expected, "write", iteration);
+            model.insert(model.end(), src.begin(), src.begin() + expected);
+            break;
+        }
+
+        case 1:
+        {
+            // the free space in place, filled only partly.
+            const auto spans = ring.writable_spans();
+            check(spans.size() == size - model.size(), "writable_spans", iteration);
+            const auto n = std::min(count, spans.size());
+            size_t k = 0;
+            for (const auto &span : spans)
+            {
+                for (auto p = span.begin(); p != span.end() && k < n; ++p, ++k)
+                    model.push_back(*p = test_random(state));
+            }
+            ring.commit_write(n);
+            break;
+        }
+
+        case 2:
+        {
+            const auto expected = std::min(count, model.size());
+            const auto n = ring.read(dst.data(), count);
+            check(n == expected && check_data(dst.data(), n, 0), "read", iteration);
+            model_read(n);
+            break;
+        }
+
+        case 3:
+        {
+            size_t n = 0;
+            bool same = true;
+            for (const auto &span : ring.readable_spans())
+            {
+                same &= check_data(span.begin(), span.size(), n);
+                n += span.size();
+            }
+            check(same && n == model.size(), "readable_spans", iteration);
+            const auto consumed = std::min(count, n);
+            ring.commit_read(consumed);
+            model_read(consumed);
+            break;
+        }
+
+        case 4:
+        {
+            // whole up to Guard, and over the seam only as far as the guard tail reaches.
+            const auto offset = ring.get_read_counter() & ring_type::mask;
+            const auto span = ring.readable_span(count);
+            const auto expected = std::min({count, model.size(), capacity + Guard - offset});
+            check(span.size() == expected && check_data(span.begin(), span.size(), 0), "readable_span", iteration);
+            check(count > Guard || span.size() == std::min(count, model.size()), "readable_span guard", iteration);
+            const auto consumed = span.size() ? test_random(state) % (span.size() + 1) : 0;
+            ring.commit_read(consumed);
+            model_read(consumed);
+            break;
+        }
+
+        case 5:
+        {
+            // whole items up to Guard long, which apply_linear() must carry over the seam until less than an item is
+            // stored, or a random part of each piece like a converter stopping short.
+            const bool items = test_random(state) % 2;
+            const size_t item = 1 + test_random(state) % std::max<size_t>(Guard, 1);
+            size_t seen = 0;
+            bool same = true;
+            const auto consumed = ring.apply_linear([&](const uint8_t *begin, const uint8_t *end) {
+                const size_t length = end - begin;
+                const size_t n = items ? length - length % item : std::min<size_t>(length, test_random(state) % (size + 1));
+                same &= check_data(begin, n, seen);
+                seen += n;
+                return n;
+            });
+            check(same && consumed == seen && consumed <= model.size(), "apply_linear data", iteration);
+            model_read(consumed);
+            check(!items || model.size() < item, "apply_linear seam", iteration);
+            break;
+        }
+        }
+
+        check(ring.used() == model.size() && ring.available() == size - model.size(), "used", iteration);
+        check(size_t(ring.get_write_counter() - ring.get_read_counter()) == model.size(), "counters", iteration);
+    }
+
+    return check.report();
+}
+
+// multi_reader_circular_buffer against the whole written stream and a 64 bit counter per side. the writer runs past
+// the readers at times, so lapped readers and their resync are taken too.
+bool test_multi_reader_circular_buffer(uint32_t seed, uint32_t iterations)
+{
+    constexpr size_t capacity = 61;
+    constexpr uint8_t readers = 2;
+    using ring_type = data_structure::multi_reader_circular_buffer<data_structure::container_array<uint8_t, capacity>, readers>;
+
+    struct model_reader
+    {
+        uint64_t counter = 0;
+        bool attached = false;
+    };
+
+    static ring_type ring;
+    std::vector<uint8_t> stream;
+    std::array<model_reader, readers> model;
+
+    uint32_t state = seed;
+    test_checker check = { "multi_reader_circular_buffer" };
+
+    // the ring outlives a seed, readers included.
+    size_t size = capacity;
+    ring.resize(size);
+    for (uint8_t r = 0; r < readers; ++r)
+        ring.detach_reader(r);
+
+    auto model_lag = [&](uint8_t reader) { return size_t(stream.size() - model[reader].counter); };
+    auto check_data = [&](const uint8_t *p, size_t count, uint64_t from) {
+        bool same = from + count <= stream.size();
+        for (size_t k = 0; same && k < count; ++k)
+            same = p[k] == stream[from + k];
+        return same;
+    };
+
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        if (test_random(state) % 256 == 0)
+        {
+            size = 1 + test_random(state) % capacity;
+            ring.resize(size);
+            stream.clear();
+            for (auto &reader : model)
+                reader.counter = 0;
+        }
+
+        const uint8_t reader = test_random(state) % readers;
+        const size_t count = test_random(state) % (size * 3);
+        const size_t keep = test_random(state) % size;
+        auto &cursor = model[reader];
+
+        switch (test_random(state) % 6)
+        {
+        case 0:
+        {
+            // mostly within the free space, sometimes over the readers.
+            size_t max_lag = 0;
+            for (uint8_t r = 0; r < readers; ++r)
+                max_lag = model[r].attached ? std::max(max_lag, model_lag(r)) : max_lag;
+            const auto available = max_lag < size ? size - max_lag : 0;
+            check(ring.available() == available, "available", iteration);
+
+            const auto n = test_random(state) % 4 ? std::min(count, available) : count;
+            auto addr = ring.get_write_addr();
+            for (size_t k = 0; k < n; ++k, addr = ring.advance(addr, 1))
+            {
+                stream.push_back(test_random(state));
+                *addr = stream.back();
+            }
+            ring.commit_write(n);
+            break;
+        }
+
+        case 1:
+            if (cursor.attached)
+            {
+                ring.detach_reader(reader);
+                cursor.attached = false;
+            }
+            else
+            {
+                ring.attach_reader(reader, keep);
+                cursor.counter = stream.size() - std::min(model_lag(reader), keep);
+                cursor.attached = true;
+            }
+            break;
+
+        case 2:
+        {
+            // placed from the writer, keep behind it at most.
+            const auto lag = model_lag(reader);
+            const auto behind = std::min(lag, keep);
+            check(ring.resync(reader, keep) == lag - behind, "resync", iteration);
+            cursor.counter = stream.size() - behind;
+            break;
+        }
+
+        case 3:
+        {
+            if (ring.is_lapped(reader))
+                break;
+            size_t n = 0;
+            bool same = true;
+            for (const auto &span : ring.readable_spans(reader, count))
+            {
+                same &= check_data(span.begin(), span.size(), cursor.counter + n);
+                n += span.size();
+            }
+            check(same && n == std::min(count, model_lag(reader)), "readable_spans", iteration);
+            const auto consumed = std::min(count, n);
+            ring.commit_read(reader, consumed);
+            cursor.counter += consumed;
+            break;
+        }
+
+        case 4:
+        {
+            if (ring.is_lapped(reader))
+                break;
+            size_t seen = 0;
+            bool same = true;
+            const auto consumed = ring.apply_linear(reader, [&](const uint8_t *begin, const uint8_t *end) {
+                const size_t n = std::min<size_t>(end - begin, test_random(state) % (size + 1));
+                same &= check_data(begin, n, cursor.counter + seen);
+                seen += n;
+                return n;
+            });
+            check(same && consumed == seen && consumed <= model_lag(reader), "apply_linear data", iteration);
+            cursor.counter += consumed;
+            break;
+        }
+
+        case 5:
+        {
+            // a lapped reader may skip more than the whole ring.
+            const auto n = std::min(count, model_lag(reader));
+            ring.commit_read(reader, n);
+            cursor.counter += n;
+            break;
+        }
+        }
+
+        for (uint8_t r = 0; r < readers; ++r)
+        {
+            const auto lag = model_lag(r);
+            check(ring.lag(r) == lag && ring.is_lapped(r) == (lag >= size), "lag", iteration);
+            check(ring.get_read_counter(r) == uint32_t(model[r].counter), "read counter", iteration);
+            check(ring.get_read_addr(r) == ring.begin() + model[r].counter % size, "read addr", iteration);
+        }
+        check(ring.get_write_counter() == uint32_t(stream.size()), "write counter", iteration);
+        check(ring.get_write_addr() == ring.begin() + stream.size() % size, "write addr", iteration);
+    }
+
+    return check.report();
+}
+
+// bytes per call over a ring the size of the usb out buffer, in rounds that wrap.
+void measure_circular_buffer(uint32_t block_size)
+{
+    dbg_printf("measure_circular_buffer block=%u\n", block_size);
+
+    constexpr size_t capacity = 48 * 8 * 4 * 2;
+    constexpr uint32_t rounds = 256;
+    using ring_type = data_structure::circular_buffer<data_structure::container_array<uint8_t, capacity>>;
+
+    static ring_type ring;
+    static std::array<uint8_t, capacity> block;
+    block_size = std::min<uint32_t>(block_size, capacity - 1);
+
+    auto report = [&](const char* label, uint32_t spent) {
+        dbg_printf("  %s: spent %u (%u bytes)\n", label, spent, rounds * block_size);
+    };
+
+    auto pos = ring.begin();
+    auto time = time_us_32();
+    for (uint32_t i = 0; i < rounds; ++i)
+        pos = ring.write(pos, block.begin(), block_size);
+    report("write", time_us_32() - time);
+
+    pos = ring.begin();
+    time = time_us_32();
+    for (uint32_t i = 0; i < rounds; ++i)
+        pos = ring.copy_to(pos, block.begin(), block_size);
+    report("copy_to", time_us_32() - time);
+
+    // the limit trails one byte behind, so every round takes the wrapping branch at some point.
+    pos = ring.begin();
+    time = time_us_32();
+    for (uint32_t i = 0; i < rounds; ++i)
+        pos = ring.advance(ring.advance(pos, capacity - 1), pos, block_size);
+    report("advance", time_us_32() - time);
+
+    uint32_t sum = 0;
+    pos = ring.begin();
+    time = time_us_32();
+    for (uint32_t i = 0; i < rounds; ++i)
+    {
+        pos = ring.apply_linear(ring.advance(pos, block_size), pos, [&](const uint8_t *begin, const uint8_t *end) {
+            for (auto p = begin; p != end; ++p)
+                sum += *p;
+            return size_t(end - begin);
+        });
+    }
+    report("apply_linear", time_us_32() - time);
+    dbg_printf("  sum %u\n", sum);
+}
+
+int main(int argc, char *argv[])
+{
+    // a failed dbg_assert aborts, the seed it failed in must already be out.
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    if (argc > 1 && strcmp(argv[1], "measure") == 0)
+    {
+        measure_circular_buffer(4);
+        measure_circular_buffer(192);
+        measure_circular_buffer(1152);
+        return 0;
+    }
+
+    const uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+
+    bool result = true;
+    for (uint32_t seed = 1; seed <= 16; ++seed)
+    {
+        dbg_printf("seed=%u\n", seed);
+        result &= test_circular_buffer(seed, iterations);
+        result &= test_masked_circular_buffer<0>(seed, iterations);
+        result &= test_masked_circular_buffer<24>(seed, iterations);
+        result &= test_multi_reader_circular_buffer(seed, iterations);
+    }
+
+    dbg_printf("%s\n", result ? "all ok" : "failed");
+    return result ? 0 : 1;
+}